@@ -0,0 +1,77 @@
+#include <algorithm>
+
+#include "AssetLoader.h"
+
+AssetLoader::AssetLoader(unsigned thread_count)
+    : m_parse_pool(std::max(thread_count / 4, 1u))
+    , m_max_workers(std::clamp(thread_count, 1u, MAX_LOADER_THREADS))
+{
+}
+
+AssetLoader::~AssetLoader()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+        m_jobs.clear();
+    }
+    m_wake.notify_all();
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+}
+
+Asset<mesh_t> AssetLoader::load_mesh(std::string filename)
+{
+    return submit<mesh_t>([this, filename] {
+        auto mesh = std::make_shared<mesh_t>();
+        if (!load_obj_file_data(mesh.get(), filename, &m_parse_pool)) {
+            return std::shared_ptr<mesh_t>();
+        }
+        return mesh;
+    });
+}
+
+Asset<Texture> AssetLoader::load_texture(std::string filename)
+{
+    return submit<Texture>([filename] {
+        return std::shared_ptr<Texture>(load_png_texture_data(filename));
+    });
+}
+
+template<typename T>
+Asset<T> AssetLoader::submit(std::function<std::shared_ptr<T>()> load)
+{
+    auto task = std::make_shared<std::packaged_task<std::shared_ptr<T>()>>(std::move(load));
+    Asset<T> asset = task->get_future().share();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back([task] { (*task)(); });
+
+        // Only start another worker when the ones waiting can't take every job
+        if (m_jobs.size() > m_idle && m_workers.size() < m_max_workers) {
+            m_workers.emplace_back(&AssetLoader::worker_loop, this);
+        }
+    }
+    m_wake.notify_one();
+    return asset;
+}
+
+void AssetLoader::worker_loop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_idle++;
+        m_wake.wait(lock, [&] { return m_stop || !m_jobs.empty(); });
+        m_idle--;
+        if (m_stop) {
+            return;
+        }
+        auto job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+
+        lock.unlock();
+        job();
+        lock.lock();
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ThreadPool.h"
+#include "mesh.h"
+#include "texture.h"
+
+// Most files read at once, a few are enough to overlap parsing with decoding
+constexpr unsigned MAX_LOADER_THREADS = 4;
+
+// Handle to an asset loading in the background, the value is nullptr when loading failed
+template<typename T>
+using Asset = std::shared_future<std::shared_ptr<T>>;
+
+// True once the asset finished loading, successfully or not, without blocking
+template<typename T>
+bool is_ready(const Asset<T>& asset)
+{
+    return asset.valid() && asset.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+/* A job queue with worker threads of its own for reading assets from disk. OBJ parsing and PNG
+   decoding of different files overlap each other, and unlike the fork-join ThreadPool the caller
+   never waits: every request returns a handle straight away, so frames can be rendered while the
+   assets are still coming in. Jobs start in the order they were requested. Large OBJ files are
+   parsed in parallel on a pool of the loader's own, never on the one busy with the frames. */
+class AssetLoader {
+public:
+    // Workers are started as jobs come in, at most one per job waiting and never more than
+    // MAX_LOADER_THREADS. The parse pool gets a quarter of thread_count, leaving the rest to the frames.
+    AssetLoader(unsigned thread_count = std::thread::hardware_concurrency());
+
+    // Jobs that haven't started yet are dropped, waiting on their handles throws
+    ~AssetLoader();
+
+    Asset<mesh_t> load_mesh(std::string filename);
+    Asset<Texture> load_texture(std::string filename);
+
+private:
+    template<typename T>
+    Asset<T> submit(std::function<std::shared_ptr<T>()> load);
+    void worker_loop();
+
+    // Shared by the workers, which take turns when more than one large file is parsed at once
+    ThreadPool m_parse_pool;
+
+    std::vector<std::thread> m_workers;
+    unsigned m_max_workers;
+    size_t m_idle = 0; // workers waiting for a job
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::deque<std::function<void()>> m_jobs;
+    bool m_stop = false;
+};
@@ -0,0 +1,37 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <string>
+
+#include "Framebuffer.h"
+
+// Presentation backend selected at startup
+enum class Backend {
+    Window,
+    Headless
+};
+
+// A display takes the finished framebuffer and presents it somewhere
+class Display {
+public:
+    virtual ~Display() = default;
+
+    virtual void render() = 0;
+    virtual bool poll_event(SDL_Event* event) = 0;
+    virtual void set_title(std::string title) = 0;
+
+    int get_width() { return m_width; }
+    int get_height() { return m_height; }
+
+    // Present another framebuffer of the same size from the next render on
+    void set_framebuffer(Framebuffer* fb) { m_fb = fb; }
+
+protected:
+    Display(Framebuffer* fb, int width, int height)
+        : m_fb(fb)
+        , m_width(width)
+        , m_height(height) {};
+
+    Framebuffer* m_fb;
+    int m_width;
+    int m_height;
+};
@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
@@ -5,34 +9,106 @@
 #include "clipping.h"
 #include "mesh.h"
 
-std::vector<Triangle> triangles_to_render;
-
-uint32_t* mesh_texture;
+Texture* mesh_texture;
 mesh_t mesh = {
-    .faces = { {} },
+    .vertices = {},
+    .uvs = {},
+    .faces = {},
+    .storage = nullptr,
+    .color = 0xFFFFFFFF,
     .rotation = { 0, 0, 0 },
     .scale = { 1.0, 1.0, 1.0 },
     .translation = { 0, 0, 0 }
 };
 
+// Models in ./res, loaded in the background when the engine starts; the first one is shown first
+static const char* const MODEL_NAMES[] = { "efa", "cube", "f117", "f22" };
+
+// Number of mesh faces handed to a worker at a time in the geometry stage
+constexpr size_t FACES_PER_CHUNK = 1024;
+
+// Number of mesh vertices transformed by a worker at a time
+constexpr size_t VERTICES_PER_CHUNK = 4096;
+
+// Length of the scripted benchmark path in frames, longer runs go round it again
+constexpr int BENCH_PATH_FRAMES = 120;
+
 // Declaration of our global transformation matrices
 glm::mat4 proj_matrix;
 
-Engine::Engine(int width, int height)
+Engine::Engine(int width, int height, Backend backend)
 {
-    m_fb = new Framebuffer(width, height);
-    m_window = new Window(m_fb, width, height);
+    m_framebuffers[0] = new Framebuffer(width, height);
+    m_framebuffers[1] = new Framebuffer(width, height);
+    m_fb = m_framebuffers[0];
+    if (backend == Backend::Headless) {
+        m_headless = new Headless(m_fb, width, height);
+        m_display = m_headless;
+    } else {
+        m_display = new Window(m_fb, width, height);
+    }
+    m_pool = new ThreadPool();
+    m_rasterizers[0] = new Rasterizer(m_framebuffers[0], m_pool);
+    m_rasterizers[1] = new Rasterizer(m_framebuffers[1], m_pool);
+    m_geometry_stage = new StageThread();
+    m_raster_stage = new StageThread();
+    m_pacer = new FramePacer();
+
+    // With a single core there is nothing for the stages to overlap with
+    if (std::thread::hardware_concurrency() <= 1) {
+        m_max_latency = 0;
+    }
+    m_loader = new AssetLoader();
     m_light = new Light(glm::vec3(0, 0, 1));
     m_camera = new Camera(glm::vec3(0, 0, -1), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
 };
 
+void Engine::set_headless_output(HeadlessOutput output, std::string directory)
+{
+    if (m_headless) {
+        m_headless->set_output(output);
+        m_headless->set_dump_directory(directory);
+    }
+}
+
+/* Multiply count points (with w = 1) by a matrix, writing the x, y and z components into
+   separate arrays. Spelling out the matrix elements as scalars keeps the loop free of
+   dependencies between iterations, so the compiler can vectorize it. */
+static void transform_vertices(const glm::mat4& m, const glm::vec3* points, size_t count, float* out_x, float* out_y, float* out_z)
+{
+    float m00 = m[0][0], m01 = m[0][1], m02 = m[0][2];
+    float m10 = m[1][0], m11 = m[1][1], m12 = m[1][2];
+    float m20 = m[2][0], m21 = m[2][1], m22 = m[2][2];
+    float m30 = m[3][0], m31 = m[3][1], m32 = m[3][2];
+
+    for (size_t i = 0; i < count; i++) {
+        float x = points[i].x;
+        float y = points[i].y;
+        float z = points[i].z;
+        out_x[i] = (m00 * x + m10 * y) + (m20 * z + m30);
+        out_y[i] = (m01 * x + m11 * y) + (m21 * z + m31);
+        out_z[i] = (m02 * x + m12 * y) + (m22 * z + m32);
+    }
+}
+
+void Engine::set_pacing(PacingMode mode, double rate)
+{
+    m_pacer->set_rate(rate);
+    m_pacer->set_mode(mode);
+}
+
+void Engine::set_max_latency(int frames)
+{
+    m_max_latency = std::clamp(frames, 0, 2);
+}
+
 // Setup function to initialize variables and game objects
 void Engine::setup()
 {
     // Initialize the scene light direction
 
     // Initialize the perspective projection matrix
-    float aspect = (float)m_window->get_width() / (float)m_window->get_height();
+    float aspect = (float)m_display->get_width() / (float)m_display->get_height();
     float fov_y = 3.141592 / 3.0; // the same as 180/3, or 60deg
     float fov_x = atan(tan(fov_y / 2) * aspect) * 2;
     float near = 0.1;
@@ -43,11 +119,88 @@ void Engine::setup()
     // Initialize frustum planes with a point and a normal
     init_frustum_planes(fov_x, fov_y, near, far);
 
-    // Loads the vertex and face values for the mesh data structure
-    load_obj_file_data(&mesh, "./res/efa.obj");
+    // Start loading the vertex and face values and the texture of every model in the background,
+    // frames are rendered without a mesh until the first model is ready
+    std::string directory = "./res/";
+    for (const char* name : MODEL_NAMES) {
+        m_models.push_back({ name, m_loader->load_mesh(directory + name + ".obj"), m_loader->load_texture(directory + name + ".png") });
+    }
+
+    // Headless runs dump a fixed number of frames for comparison, so they wait for the first model
+    if (m_headless && !wait_for_models(1)) {
+        m_failed = true;
+        m_is_running = false;
+        return;
+    }
+    show_model(0);
+
+    // Start timing frames from here, the first one would otherwise animate by the time setup took
+    m_pacer->set_mode(m_pacer->get_mode());
+}
+
+// Wait for the first count models to finish loading, naming every one that failed
+bool Engine::wait_for_models(size_t count)
+{
+    bool loaded = true;
+    for (size_t index = 0; index < count; index++) {
+        const Model& model = m_models[index];
+        model.mesh.wait();
+        model.texture.wait();
+        if (!model.mesh.get() || !model.texture.get()) {
+            fprintf(stderr, "Error: could not load the %s model.\n", model.name.c_str());
+            loaded = false;
+        }
+    }
+    return loaded;
+}
+
+// Ask for a model to be drawn, it replaces the current one once both of its assets are loaded
+void Engine::show_model(size_t index)
+{
+    m_model = index;
+    m_model_shown = false;
+    poll_assets();
+}
+
+// Swap in the requested model as soon as its mesh and texture are loaded
+void Engine::poll_assets()
+{
+    // The loader and its threads are only needed until every model finished loading, one way or the other
+    if (m_loader && std::all_of(m_models.begin(), m_models.end(), [](const Model& model) { return is_ready(model.mesh) && is_ready(model.texture); })) {
+        delete m_loader;
+        m_loader = nullptr;
+    }
+
+    if (m_model_shown) {
+        return;
+    }
+
+    const Model& model = m_models[m_model];
+    if (!is_ready(model.mesh) || !is_ready(model.texture)) {
+        return;
+    }
+    m_model_shown = true;
+
+    // The loaders reported the error, keep drawing the current model if there is one. Without one
+    // stop running, this may be the geometry thread so the main thread is left to exit.
+    std::shared_ptr<mesh_t> loaded_mesh = model.mesh.get();
+    std::shared_ptr<Texture> loaded_texture = model.texture.get();
+    if (!loaded_mesh || !loaded_texture) {
+        if (!m_any_model_shown) {
+            m_failed = true;
+            m_is_running = false;
+        }
+        return;
+    }
 
-    // Load the texture information from an external PNG file
-    mesh_texture = load_png_texture_data("./res/efa.png");
+    // Keep the transform of the mesh drawn so far, the model owns the arrays and the texture
+    mesh.vertices = loaded_mesh->vertices;
+    mesh.uvs = loaded_mesh->uvs;
+    mesh.faces = loaded_mesh->faces;
+    mesh.storage = loaded_mesh->storage;
+    mesh_texture = loaded_texture.get();
+    mesh_texture->set_wrap(m_texture_wrap);
+    m_any_model_shown = true;
 }
 
 // Poll system events and handle keyboard input
@@ -57,7 +210,7 @@ void Engine::process_input()
     float sensitivity = 10.0;
 
     SDL_Event event;
-    while (SDL_PollEvent(&event)) {
+    while (m_display->poll_event(&event)) {
         switch (event.type) {
         case SDL_QUIT:
             m_is_running = false;
@@ -106,6 +259,63 @@ void Engine::process_input()
                 m_fb->set_cull_method(CullMethod::None);
                 break;
             }
+            if (event.key.keysym.sym == SDLK_e) {
+                m_fb->set_raster_method(RasterMethod::EdgeFunction);
+                break;
+            }
+            if (event.key.keysym.sym == SDLK_l) {
+                m_fb->set_raster_method(RasterMethod::Scanline);
+                break;
+            }
+            if (event.key.keysym.sym == SDLK_v) {
+                m_fb->set_clip_method(ClipMethod::ViewFrustum);
+                break;
+            }
+            if (event.key.keysym.sym == SDLK_h) {
+                m_fb->set_clip_method(ClipMethod::Homogeneous);
+                break;
+            }
+            if (event.key.keysym.sym == SDLK_g) {
+                m_fb->set_clip_method(ClipMethod::GuardBand);
+                break;
+            }
+            if (event.key.keysym.sym == SDLK_z) {
+                m_fb->set_depth_method(DepthMethod::HierarchicalZ);
+                break;
+            }
+            if (event.key.keysym.sym == SDLK_b) {
+                m_fb->set_depth_method(DepthMethod::ZBuffer);
+                break;
+            }
+            if (event.key.keysym.sym == SDLK_f) {
+                m_fb->set_sort_method(SortMethod::FrontToBack);
+                break;
+            }
+            if (event.key.keysym.sym == SDLK_r) {
+                m_fb->set_sort_method(SortMethod::BackToFront);
+                break;
+            }
+            if (event.key.keysym.sym == SDLK_n) {
+                m_fb->set_sort_method(SortMethod::None);
+                break;
+            }
+            if (event.key.keysym.sym == SDLK_t) {
+                // Toggle between repeating and clamping the texture coordinates
+                m_texture_wrap = (m_texture_wrap == TextureWrap::Repeat) ? TextureWrap::Clamp : TextureWrap::Repeat;
+                if (mesh_texture) {
+                    mesh_texture->set_wrap(m_texture_wrap);
+                }
+                break;
+            }
+            if (event.key.keysym.sym == SDLK_p) {
+                // Cycle through uncapped, fixed rate and fixed timestep pacing
+                m_pacer->set_mode((PacingMode)(((int)m_pacer->get_mode() + 1) % 3));
+                break;
+            }
+            if (event.key.keysym.sym == SDLK_m) {
+                show_model((m_model + 1) % m_models.size());
+                break;
+            }
             if (event.key.keysym.sym == SDLK_w) {
                 auto velocity = m_camera->m_direction * sensitivity * m_delta;
                 m_camera->m_position = m_camera->m_position + velocity;
@@ -131,25 +341,197 @@ void Engine::process_input()
     }
 }
 
-// Update function frame by frame with a fixed time step
-void Engine::update()
+/* Advance the frame pipeline by one step. With a maximum latency of two frames, three frames are
+   in flight at once, each in a different stage on a thread of its own:
+
+      step        s       s+1      s+2
+      geometry    N+2     N+3      N+4      geometry thread
+      raster      N+1     N+2      N+3      raster thread
+      present     N       N+1      N+2      main thread, which owns the window
+
+   At the end of a step every stage hands its frame on to the next one. The triangle lists and the
+   framebuffers are double buffered, so no stage ever touches what another one is working on, and
+   a step takes as long as its slowest stage instead of all of them. With a latency of one the main
+   thread rasterizes and presents while the next frame's geometry is prepared, and with none every
+   stage runs in turn on the main thread. Input is handled between steps, when no stage runs. */
+void Engine::run_frame()
 {
-    int time_to_wait = FRAME_TARGET_TIME - (SDL_GetTicks() - m_previous);
-    // Only delay execution if we are running too fast
-    if (time_to_wait > 0 && time_to_wait <= FRAME_TARGET_TIME) {
-        SDL_Delay(time_to_wait);
+    // Wait for the frame to be due, the time since the previous one moves the camera and the scene
+    m_delta = m_pacer->begin_frame();
+
+    int step = m_step++;
+
+    if (m_max_latency == 0) {
+        update(m_frames[0]);
+        rasterize(m_frames[0], 0);
+        present(0);
+        return;
+    }
+
+    // The settings changed by the input stay the same for every stage during the step
+    m_framebuffers[1]->copy_settings(*m_fb);
+
+    m_geometry_stage->start([this, step] { update(m_frames[step % 2]); });
+
+    int raster_frame = step - 1;
+    int present_frame = step - m_max_latency;
+    if (m_max_latency == 1) {
+        if (raster_frame >= 0) {
+            rasterize(m_frames[raster_frame % 2], 0);
+            present(0);
+        }
+    } else {
+        if (raster_frame >= 0) {
+            m_raster_stage->start([this, raster_frame] { rasterize(m_frames[raster_frame % 2], raster_frame % 2); });
+        }
+        if (present_frame >= 0) {
+            present(present_frame % 2);
+        }
+        m_raster_stage->wait();
     }
-    // Get a delta time factor converted to seconds to be used to update our game objects
-    m_delta = (SDL_GetTicks() - m_previous) / 1000.0;
-    m_previous = SDL_GetTicks();
 
-    triangles_to_render.clear();
+    m_geometry_stage->wait();
+}
 
-    // Change the mesh scale, rotation, and translation values per animation frame
-    mesh.rotation.x -= 0.2 * m_delta;
-    mesh.rotation.y -= 0.2 * m_delta;
-    mesh.rotation.z += 0.0 * m_delta;
+// Change the mesh scale, rotation, and translation values by a time step in seconds
+void Engine::simulate(float delta)
+{
+    mesh.rotation.x -= 0.2 * delta;
+    mesh.rotation.y -= 0.2 * delta;
+    mesh.rotation.z += 0.0 * delta;
     mesh.translation.z = 5.0;
+}
+
+/* Pose the scene for one frame of the benchmark path, which only depends on the frame number so
+   every run renders the same images however long its frames take. The model turns all the way
+   round and rocks about x while the camera circles slightly off axis, still looking at the origin:
+
+      camera   (0.3 sin a, 0.2 cos a, -1)      a = 2 pi frame / BENCH_PATH_FRAMES
+      model    rotation (0.3 sin a, a, 0), at z = 5
+*/
+void Engine::script_scene(int frame)
+{
+    float angle = 2 * 3.141592f * (frame % BENCH_PATH_FRAMES) / BENCH_PATH_FRAMES;
+    mesh.rotation = { 0.3f * sinf(angle), angle, 0 };
+    mesh.scale = { 1.0, 1.0, 1.0 };
+    mesh.translation = { 0, 0, 5.0 };
+    m_camera->m_position = { 0.3f * sinf(angle), 0.2f * cosf(angle), -1 };
+}
+
+// Nearest rank percentile of an ascending list of samples
+static double percentile(const std::vector<double>& sorted, double percent)
+{
+    size_t rank = (size_t)ceil(percent / 100 * sorted.size());
+    return sorted[std::clamp(rank, (size_t)1, sorted.size()) - 1];
+}
+
+/* Every model is drawn with every combination of render and cull method, one run each. A run starts
+   the pipeline empty and steps it until frames frames were presented; the frame times are those of
+   the steps that presented one. The throughput is the raster work on those same frames over the
+   time until the last of them was rasterized, which is a step before it is presented when the
+   stages overlap. At a latency of two that final step also rasterizes one frame too many, so
+   its work is left out.
+
+      { "frames": 120, ..., "runs": [
+          { "model": "cube", "render": "wire", "cull": "none",
+            "frame_ms": { "p50": 1.2, "p95": 1.5, "p99": 1.9 },
+            "triangles_per_second": 1.0e+06, "pixels_per_second": 1.0e+09 }, ... ] }
+*/
+bool Engine::run_benchmark(int frames)
+{
+    using Clock = std::chrono::steady_clock;
+
+    static const RenderMethod render_methods[] = { RenderMethod::Wire, RenderMethod::WireVertex, RenderMethod::FillTriangle,
+        RenderMethod::FillTriangleWire, RenderMethod::Textured, RenderMethod::TexturedWire };
+    static const CullMethod cull_methods[] = { CullMethod::None, CullMethod::Backface };
+
+    // Load everything up front, the benchmark is about rendering and a failure leaves no half written report.
+    // The first model was already waited for, and reported if it failed, by setup().
+    if (m_failed || !wait_for_models(m_models.size())) {
+        return false;
+    }
+
+    frames = std::max(frames, 1);
+    m_pacer->set_mode(PacingMode::Uncapped);
+    m_frame_limit = 0;
+    m_scripted = true;
+
+    printf("{\n  \"frames\": %d,\n  \"width\": %d,\n  \"height\": %d,\n  \"isa\": \"%s\",\n  \"threads\": %u,\n  \"latency\": %d,\n  \"runs\": [",
+        frames, m_fb->get_width(), m_fb->get_height(), span_isa_name(get_span_isa()), m_pool->size(), m_max_latency);
+
+    const char* separator = "\n";
+    std::vector<double> frame_times;
+    for (size_t index = 0; index < m_models.size(); index++) {
+        show_model(index);
+        for (RenderMethod render_method : render_methods) {
+            for (CullMethod cull_method : cull_methods) {
+                m_fb->set_render_method(render_method);
+                m_fb->set_cull_method(cull_method);
+
+                // No frame of the previous run is left in flight, the stages are idle between steps
+                m_step = 0;
+                m_script_frame = 0;
+                m_rasterized_triangles = 0;
+                m_rasterized_pixels = 0;
+                frame_times.clear();
+
+                // Without overlap a frame is rasterized in the step that starts it, otherwise in the next one
+                int last_raster_step = frames - 1 + (m_max_latency > 0 ? 1 : 0);
+                double seconds = 0;
+                uint64_t triangles = 0;
+                uint64_t pixels = 0;
+
+                Clock::time_point start = Clock::now();
+                for (int step = 0; step < frames + m_max_latency; step++) {
+                    Clock::time_point step_start = Clock::now();
+                    run_frame();
+                    Clock::time_point step_end = Clock::now();
+                    if (step >= m_max_latency) {
+                        frame_times.push_back(std::chrono::duration<double, std::milli>(step_end - step_start).count());
+                    }
+                    if (step == last_raster_step) {
+                        seconds = std::chrono::duration<double>(step_end - start).count();
+                        triangles = m_rasterized_triangles;
+                        pixels = m_rasterized_pixels;
+                    }
+                }
+
+                std::sort(frame_times.begin(), frame_times.end());
+                printf("%s    { \"model\": \"%s\", \"render\": \"%s\", \"cull\": \"%s\", "
+                       "\"frame_ms\": { \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f }, "
+                       "\"triangles_per_second\": %.4e, \"pixels_per_second\": %.4e }",
+                    separator, m_models[index].name.c_str(), render_method_name(render_method), cull_method_name(cull_method),
+                    percentile(frame_times, 50), percentile(frame_times, 95), percentile(frame_times, 99),
+                    triangles / seconds, pixels / seconds);
+                separator = ",\n";
+            }
+        }
+    }
+    printf("\n  ]\n}\n");
+
+    m_scripted = false;
+    return true;
+}
+
+// Geometry stage: animate the scene and transform, cull and clip it into a list of screen space triangles
+void Engine::update(GeometryFrame& frame)
+{
+    // Pick up the requested model if it finished loading since the last frame
+    poll_assets();
+
+    // Animate by the time the last frame took, or in fixed steps when the simulation is decoupled from the frame rate
+    if (m_scripted) {
+        script_scene(m_script_frame++);
+    } else if (m_headless) {
+        // Headless frames are compared between runs, so they advance by one step each whatever they took
+        simulate(m_pacer->get_timestep());
+    } else if (m_pacer->get_mode() == PacingMode::FixedTimestep) {
+        for (int steps = m_pacer->take_steps(); steps > 0; steps--) {
+            simulate(m_pacer->get_timestep());
+        }
+    } else {
+        simulate(m_delta);
+    }
 
     auto view_matrix = glm::lookAtLH(m_camera->m_position, glm::vec3(0, 0, 0), m_camera->m_up);
 
@@ -163,11 +545,84 @@ void Engine::update()
 
     // Update camera look at target to create view matrix
 
-    // Loop all triangle faces of our mesh
-    for (auto& mesh_face : mesh.faces) {
-        auto vector_a = glm::vec3(world_matrix * glm::vec4(mesh_face.a.point, 1.0));
-        auto vector_b = glm::vec3(world_matrix * glm::vec4(mesh_face.b.point, 1.0));
-        auto vector_c = glm::vec3(world_matrix * glm::vec4(mesh_face.c.point, 1.0));
+    // Transform every unique vertex once, the faces below only gather the results
+    size_t num_vertices = mesh.vertices.size();
+    m_view_vertices.x.resize(num_vertices);
+    m_view_vertices.y.resize(num_vertices);
+    m_view_vertices.z.resize(num_vertices);
+    m_view_vertices.outcode.resize(num_vertices);
+
+    bool clip_homogeneous = m_fb->should_clip_homogeneous();
+    float guard_band = m_fb->should_use_guard_band() ? GUARD_BAND_SCALE : 1.0f;
+    if (clip_homogeneous) {
+        m_view_vertices.clip.resize(num_vertices);
+        m_view_vertices.screen.resize(num_vertices);
+        m_view_vertices.clipcode.resize(num_vertices);
+    }
+
+    size_t num_vertex_chunks = (num_vertices + VERTICES_PER_CHUNK - 1) / VERTICES_PER_CHUNK;
+    m_pool->parallel_for(num_vertex_chunks, [&](size_t chunk) {
+        size_t begin = chunk * VERTICES_PER_CHUNK;
+        size_t end = std::min(begin + VERTICES_PER_CHUNK, num_vertices);
+        transform_vertices(world_matrix, &mesh.vertices[begin], end - begin,
+            &m_view_vertices.x[begin], &m_view_vertices.y[begin], &m_view_vertices.z[begin]);
+        for (size_t i = begin; i < end; i++) {
+            glm::vec3 point = { m_view_vertices.x[i], m_view_vertices.y[i], m_view_vertices.z[i] };
+            if (!clip_homogeneous) {
+                m_view_vertices.outcode[i] = frustum_outcode(point);
+                continue;
+            }
+
+            // Project every unique vertex once, faces that need no clipping just gather the results
+            glm::vec4 clip_point = proj_matrix * glm::vec4(point, 1);
+            m_view_vertices.clip[i] = clip_point;
+            m_view_vertices.screen[i] = clip_to_screen(clip_point);
+            m_view_vertices.outcode[i] = clip_space_outcode(clip_point, 1.0f);
+            m_view_vertices.clipcode[i] = clip_space_outcode(clip_point, guard_band);
+        }
+    });
+
+    // Split the faces into fixed size chunks so the output order never depends on the thread count
+    size_t num_chunks = (mesh.faces.size() + FACES_PER_CHUNK - 1) / FACES_PER_CHUNK;
+    if (m_chunk_triangles.size() < num_chunks) {
+        m_chunk_triangles.resize(num_chunks);
+    }
+
+    m_pool->parallel_for(num_chunks, [&](size_t chunk) {
+        size_t begin = chunk * FACES_PER_CHUNK;
+        size_t end = std::min(begin + FACES_PER_CHUNK, mesh.faces.size());
+        m_chunk_triangles[chunk].reset();
+        process_faces(begin, end, m_chunk_triangles[chunk]);
+    });
+
+    // Merge the chunk outputs back together in face order
+    size_t num_triangles = 0;
+    for (size_t chunk = 0; chunk < num_chunks; chunk++) {
+        num_triangles += m_chunk_triangles[chunk].size();
+    }
+    frame.triangles.reset();
+    frame.triangles.reserve(num_triangles);
+    for (size_t chunk = 0; chunk < num_chunks; chunk++) {
+        frame.triangles.append(m_chunk_triangles[chunk]);
+    }
+    frame.texture = mesh_texture;
+}
+
+// Cull, clip, project and light the faces in [begin, end), appending the results to output
+void Engine::process_faces(size_t begin, size_t end, TriangleArena& output)
+{
+    const float* view_x = m_view_vertices.x.data();
+    const float* view_y = m_view_vertices.y.data();
+    const float* view_z = m_view_vertices.z.data();
+    float guard_band = m_fb->should_use_guard_band() ? GUARD_BAND_SCALE : 1.0f;
+
+    for (size_t i = begin; i < end; i++) {
+        auto& mesh_face = mesh.faces[i];
+
+        // Gather the three vertices already transformed into view space
+        glm::vec3 vector_a = { view_x[mesh_face.a], view_y[mesh_face.a], view_z[mesh_face.a] };
+        glm::vec3 vector_b = { view_x[mesh_face.b], view_y[mesh_face.b], view_z[mesh_face.b] };
+        glm::vec3 vector_c = { view_x[mesh_face.c], view_y[mesh_face.c], view_z[mesh_face.c] };
 
         // Get the vector subtraction of B-A and C-A
         glm::vec3 vector_ab = glm::normalize(vector_b - vector_a);
@@ -189,110 +644,141 @@ void Engine::update()
             }
         }
 
-        Polygon polygon(vector_a, vector_b, vector_c, mesh_face.a.uv, mesh_face.b.uv, mesh_face.c.uv);
-        auto triangles = polygon.clipped_triangles();
+        // Find which frustum planes each vertex is outside of
+        uint8_t outcode_a = m_view_vertices.outcode[mesh_face.a];
+        uint8_t outcode_b = m_view_vertices.outcode[mesh_face.b];
+        uint8_t outcode_c = m_view_vertices.outcode[mesh_face.c];
 
-        // Loops all the assembled triangles after clipping
-        for (size_t t = 0; t < triangles.size(); t++) {
-            Triangle triangle_after_clipping = triangles[t];
+        // Trivial reject, all three vertices are outside of the same plane
+        if (outcode_a & outcode_b & outcode_c) {
+            continue;
+        }
 
-            glm::vec4 projected_points[3];
+        // Calculate the triangle color based on the light angle
+        uint32_t triangle_color = m_light->calculate_light_color(mesh.color, normal);
 
-            // Loop all three vertices to perform projection and conversion to screen space
-            for (int j = 0; j < 3; j++) {
-                // Project the current vertex using a perspective projection matrix
-                projected_points[j] = proj_matrix * triangle_after_clipping.points[j];
+        if (m_fb->should_clip_homogeneous()) {
+            uint8_t planes = m_view_vertices.clipcode[mesh_face.a] | m_view_vertices.clipcode[mesh_face.b] | m_view_vertices.clipcode[mesh_face.c];
 
-                // Perform perspective divide
-                if (projected_points[j].w != 0) {
-                    projected_points[j].x /= projected_points[j].w;
-                    projected_points[j].y /= projected_points[j].w;
-                    projected_points[j].z /= projected_points[j].w;
-                }
+            // Inside the frustum (or the guard band), the projected vertices can be used as they are
+            if (planes == 0) {
+                output.push(m_view_vertices.screen[mesh_face.a], m_view_vertices.screen[mesh_face.b], m_view_vertices.screen[mesh_face.c],
+                    mesh.uvs[mesh_face.a], mesh.uvs[mesh_face.b], mesh.uvs[mesh_face.c], triangle_color);
+                continue;
+            }
+
+            ClipSpacePolygon polygon(m_view_vertices.clip[mesh_face.a], m_view_vertices.clip[mesh_face.b], m_view_vertices.clip[mesh_face.c],
+                mesh.uvs[mesh_face.a], mesh.uvs[mesh_face.b], mesh.uvs[mesh_face.c]);
+            Triangle triangles[MAX_NUM_POLY_TRIANGLES];
+            int num_triangles = polygon.clipped_triangles(planes, guard_band, triangles);
+
+            // The clipped vertices are already in clip space and only need the divide
+            for (int t = 0; t < num_triangles; t++) {
+                output.push(clip_to_screen(triangles[t].points[0]), clip_to_screen(triangles[t].points[1]), clip_to_screen(triangles[t].points[2]),
+                    triangles[t].uvs[0], triangles[t].uvs[1], triangles[t].uvs[2], triangle_color);
+            }
+            continue;
+        }
 
-                // Flip vertically since the y values of the 3D mesh grow bottom->up and in screen space y values grow top->down
-                projected_points[j].y *= -1;
-
-                // Scale into the view
-                projected_points[j].x *= (m_window->get_width() / 2.0);
-                projected_points[j].y *= (m_window->get_height() / 2.0);
-
-                // Translate the projected points to the middle of the screen
-                projected_points[j].x += (m_window->get_width() / 2.0);
-                projected_points[j].y += (m_window->get_height() / 2.0);
-            }
-
-            // Calculate the triangle color based on the light angle
-            uint32_t triangle_color = m_light->calculate_light_color(mesh_face.color, normal);
-
-            // Create the final projected triangle that will be rendered in screen space
-            Triangle triangle_to_render = {
-                .points = {
-                    { projected_points[0].x, projected_points[0].y, projected_points[0].z, projected_points[0].w },
-                    { projected_points[1].x, projected_points[1].y, projected_points[1].z, projected_points[1].w },
-                    { projected_points[2].x, projected_points[2].y, projected_points[2].z, projected_points[2].w },
-                },
-                .uvs = {
-                    { triangle_after_clipping.uvs[0].x, triangle_after_clipping.uvs[0].y },
-                    { triangle_after_clipping.uvs[1].x, triangle_after_clipping.uvs[1].y },
-                    { triangle_after_clipping.uvs[2].x, triangle_after_clipping.uvs[2].y },
-                },
+        // Trivial accept, the whole triangle is inside the frustum and needs no clipping
+        if ((outcode_a | outcode_b | outcode_c) == 0) {
+            Triangle triangle = {
+                .points = { glm::vec4(vector_a, 1), glm::vec4(vector_b, 1), glm::vec4(vector_c, 1) },
+                .uvs = { mesh.uvs[mesh_face.a], mesh.uvs[mesh_face.b], mesh.uvs[mesh_face.c] },
                 .color = triangle_color
             };
+            project_triangle(triangle, triangle_color, output);
+            continue;
+        }
+
+        // Only triangles straddling a frustum plane go through the clipper
+        Polygon polygon(vector_a, vector_b, vector_c, mesh.uvs[mesh_face.a], mesh.uvs[mesh_face.b], mesh.uvs[mesh_face.c]);
+        Triangle triangles[MAX_NUM_POLY_TRIANGLES];
+        int num_triangles = polygon.clipped_triangles(triangles);
 
-            // Save the projected triangle in the array of triangles to render
-            triangles_to_render.push_back(triangle_to_render);
+        // Loops all the assembled triangles after clipping
+        for (int t = 0; t < num_triangles; t++) {
+            project_triangle(triangles[t], triangle_color, output);
         }
     }
 }
 
-// Render function to draw objects on the display
-void Engine::render()
+// Project a view space triangle to screen space and append it to output
+void Engine::project_triangle(const Triangle& triangle_after_clipping, uint32_t triangle_color, TriangleArena& output)
 {
-    // Clear all the arrays to get ready for the next frame
-    m_fb->clear_color(0xFF000000);
-    m_fb->clear_depth();
-
-    m_fb->draw_grid();
-
-    // Loop all projected triangles and render them
-    for (auto& triangle : triangles_to_render) {
-
-        // Draw filled triangle
-        if (m_fb->should_render_filled_triangle()) {
-            m_fb->draw_filled_triangle(
-                triangle.points[0].x, triangle.points[0].y, triangle.points[0].z, triangle.points[0].w, // vertex A
-                triangle.points[1].x, triangle.points[1].y, triangle.points[1].z, triangle.points[1].w, // vertex B
-                triangle.points[2].x, triangle.points[2].y, triangle.points[2].z, triangle.points[2].w, // vertex C
-                triangle.color);
-        }
+    glm::vec4 projected_points[3];
 
-        // Draw textured triangle
-        if (m_fb->should_render_textured_triangle()) {
-            m_fb->draw_textured_triangle(
-                triangle.points[0].x, triangle.points[0].y, triangle.points[0].z, triangle.points[0].w, triangle.uvs[0].x, triangle.uvs[0].y, // vertex A
-                triangle.points[1].x, triangle.points[1].y, triangle.points[1].z, triangle.points[1].w, triangle.uvs[1].x, triangle.uvs[1].y, // vertex B
-                triangle.points[2].x, triangle.points[2].y, triangle.points[2].z, triangle.points[2].w, triangle.uvs[2].x, triangle.uvs[2].y, // vertex C
-                mesh_texture);
-        }
+    // Loop all three vertices to perform projection and conversion to screen space
+    for (int j = 0; j < 3; j++) {
+        // Project the current vertex using a perspective projection matrix
+        projected_points[j] = clip_to_screen(proj_matrix * triangle_after_clipping.points[j]);
+    }
 
-        // Draw triangle wireframe
-        if (m_fb->should_render_wire()) {
-            m_fb->draw_triangle(
-                triangle.points[0].x, triangle.points[0].y, // vertex A
-                triangle.points[1].x, triangle.points[1].y, // vertex B
-                triangle.points[2].x, triangle.points[2].y, // vertex C
-                0xFFFFFFFF);
-        }
+    // Save the projected triangle in the chunk output
+    output.push(projected_points[0], projected_points[1], projected_points[2],
+        triangle_after_clipping.uvs[0], triangle_after_clipping.uvs[1], triangle_after_clipping.uvs[2], triangle_color);
+}
 
-        // Draw triangle vertex points
-        if (m_fb->should_render_wire_vertex()) {
-            m_fb->draw_rect(triangle.points[0].x - 3, triangle.points[0].y - 3, 6, 6, 0xFF0000FF); // vertex A
-            m_fb->draw_rect(triangle.points[1].x - 3, triangle.points[1].y - 3, 6, 6, 0xFF0000FF); // vertex B
-            m_fb->draw_rect(triangle.points[2].x - 3, triangle.points[2].y - 3, 6, 6, 0xFF0000FF); // vertex C
-        }
+// Perspective divide and viewport transform of a clip space point, w is kept for interpolation
+glm::vec4 Engine::clip_to_screen(glm::vec4 point)
+{
+    // Perform perspective divide
+    if (point.w != 0) {
+        point.x /= point.w;
+        point.y /= point.w;
+        point.z /= point.w;
+    }
+
+    // Flip vertically since the y values of the 3D mesh grow bottom->up and in screen space y values grow top->down
+    point.y *= -1;
+
+    // Scale into the view
+    point.x *= (m_display->get_width() / 2.0);
+    point.y *= (m_display->get_height() / 2.0);
+
+    // Translate the projected points to the middle of the screen
+    point.x += (m_display->get_width() / 2.0);
+    point.y += (m_display->get_height() / 2.0);
+
+    return point;
+}
+
+// Raster stage: draw the triangles of a frame into one of the framebuffers
+void Engine::rasterize(const GeometryFrame& frame, int target)
+{
+    // Restore the background with its grid and clear the depth to get ready for the next frame
+    m_framebuffers[target]->clear_color();
+    m_framebuffers[target]->clear_depth();
+
+    // Bin the projected triangles into screen tiles and rasterize them in parallel
+    m_rasterizers[target]->draw(frame.triangles, frame.texture);
+
+    m_rasterized_triangles += frame.triangles.size();
+    m_rasterized_pixels += m_rasterizers[target]->get_pixels_written();
+}
+
+// Present stage: show a finished framebuffer on the display
+void Engine::present(int target)
+{
+    // Once a second show the frame rate and how many times the last frame drew each covered pixel.
+    // Headless displays have no title, and the benchmark would time the scan of the frame.
+    m_fps++;
+    if (!m_headless && SDL_GetTicks() - m_fps_timer >= 1000) {
+        int covered = m_framebuffers[target]->count_covered_pixels();
+        float overdraw = covered > 0 ? (float)m_rasterizers[target]->get_shaded_pixels() / covered : 0;
+        char title[64];
+        snprintf(title, sizeof(title), "%d fps, overdraw %.2fx", m_fps, overdraw);
+        m_display->set_title(title);
+        m_fps = 0;
+        m_fps_timer = SDL_GetTicks();
     }
 
-    // Finally draw the color buffer to the SDL window
-    m_window->render();
+    // Finally present the color buffer on the display
+    m_display->set_framebuffer(m_framebuffers[target]);
+    m_display->render();
+
+    m_frame_count++;
+    if (m_frame_limit > 0 && m_frame_count >= m_frame_limit) {
+        m_is_running = false;
+    }
 }
@@ -1,29 +1,139 @@
 #pragma once
+#include <cstdint>
+#include <vector>
 
+#include "AssetLoader.h"
 #include "Camera.h"
+#include "Display.h"
+#include "FramePacer.h"
 #include "Framebuffer.h"
+#include "Headless.h"
 #include "Light.h"
+#include "Rasterizer.h"
+#include "StageThread.h"
+#include "ThreadPool.h"
+#include "TriangleArena.h"
+#include "triangle.h"
 #include "Window.h"
 
+// View space positions of every mesh vertex for the current frame, one array per component
+struct TransformedVertices {
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<uint8_t> outcode; // frustum planes the vertex is outside of
+
+    // Only filled when clipping in homogeneous clip space
+    std::vector<glm::vec4> clip; // clip space position
+    std::vector<glm::vec4> screen; // screen space position after the perspective divide
+    std::vector<uint8_t> clipcode; // planes the vertex needs real clipping against, ignoring the guard band
+};
+
+// Output of the geometry stage for one frame, rasterized during a later step of the pipeline
+struct GeometryFrame {
+    TriangleArena triangles; // screen space triangles in submission order
+    const Texture* texture = nullptr;
+};
+
+// Frames rendered for every model and method combination of the benchmark unless told otherwise
+constexpr int DEFAULT_BENCH_FRAMES = 120;
+
+// A mesh of the scene and the texture mapped onto it, either of them may still be loading
+struct Model {
+    std::string name;
+    Asset<mesh_t> mesh;
+    Asset<Texture> texture;
+};
+
 class Engine {
 public:
-    Engine(int width, int height);
+    Engine(int width, int height, Backend backend = Backend::Window);
     void setup();
     void process_input();
-    void update();
-    void render();
+
+    // Advance every stage of the frame pipeline by one frame
+    void run_frame();
 
     bool is_running() { return m_is_running; };
 
+    // Stopped because no model could be loaded
+    bool has_failed() { return m_failed; };
+
+    // Stop running after a fixed number of rendered frames (0 runs until quit)
+    void set_frame_limit(int frames) { m_frame_limit = frames; };
+    void set_headless_output(HeadlessOutput output, std::string directory);
+
+    // Frame pacing, the rate is frames per second or simulation steps per second with PacingMode::FixedTimestep
+    void set_pacing(PacingMode mode, double rate);
+
+    // Frames the geometry stage may run ahead of the one presented (0 to 2), 0 runs the stages one
+    // after another. Defaults to 2, or 0 on a single core.
+    void set_max_latency(int frames);
+
+    // How the textures of the models treat texture coordinates outside of [0, 1)
+    void set_texture_wrap(TextureWrap wrap) { m_texture_wrap = wrap; };
+
+    // Render every model with every render and cull method along a scripted path, uncapped, and print
+    // frame time percentiles and throughput as JSON on stdout. Returns false when a model fails to load.
+    bool run_benchmark(int frames);
+
 private:
+    void script_scene(int frame);
+    void simulate(float delta);
+    void update(GeometryFrame& frame);
+    void rasterize(const GeometryFrame& frame, int target);
+    void present(int target);
+    bool wait_for_models(size_t count);
+    void show_model(size_t index);
+    void poll_assets();
+    void process_faces(size_t begin, size_t end, TriangleArena& output);
+    void project_triangle(const Triangle& triangle_after_clipping, uint32_t triangle_color, TriangleArena& output);
+    glm::vec4 clip_to_screen(glm::vec4 point);
+
     bool m_is_running = true;
+    bool m_failed = false;
     int m_fps = 0;
     int m_fps_timer = 0;
-    float m_delta = 0;
-    int m_previous = 0;
+    float m_delta = 0; // seconds since the previous frame started
+    int m_frame_count = 0;
+    int m_frame_limit = 0;
+    int m_max_latency = 2;
+    int m_step = 0; // pipeline steps run so far
+
+    // The benchmark poses the scene by frame number instead of animating it by the time passed
+    bool m_scripted = false;
+    int m_script_frame = 0; // next frame of the scripted path, only touched by the geometry stage
+
+    // Work done by the raster stage, for the benchmark throughput
+    uint64_t m_rasterized_triangles = 0;
+    uint64_t m_rasterized_pixels = 0;
 
-    Window* m_window;
-    Framebuffer* m_fb;
+    Display* m_display;
+    Headless* m_headless = nullptr;
+    Framebuffer* m_fb; // the settings are changed on this one and copied to the other framebuffer
     Light* m_light;
     Camera* m_camera;
+    ThreadPool* m_pool;
+    AssetLoader* m_loader; // deleted once every model is loaded
+    FramePacer* m_pacer;
+
+    // The raster stage fills one framebuffer while the other is presented
+    Framebuffer* m_framebuffers[2];
+    Rasterizer* m_rasterizers[2];
+    StageThread* m_geometry_stage;
+    StageThread* m_raster_stage;
+
+    std::vector<Model> m_models;
+    size_t m_model = 0; // model requested for display
+    bool m_model_shown = false; // the requested model finished loading and is the one drawn
+    bool m_any_model_shown = false;
+    TextureWrap m_texture_wrap = TextureWrap::Repeat;
+
+    TransformedVertices m_view_vertices;
+
+    // Per chunk output of the geometry stage, kept around so the capacity is reused every frame
+    std::vector<TriangleArena> m_chunk_triangles;
+
+    // The geometry stage fills one while the raster stage reads the other
+    GeometryFrame m_frames[2];
 };
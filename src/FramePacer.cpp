@@ -0,0 +1,69 @@
+#include <algorithm>
+#include <thread>
+
+#include "FramePacer.h"
+
+// Sleeping can overshoot by a scheduler tick, so the last stretch before a deadline is spun instead
+constexpr auto SPIN_TIME = std::chrono::microseconds(2000);
+
+// Most simulation steps a single frame catches up on, a slow frame skips time beyond that
+// rather than making the next frame slower still
+constexpr int MAX_STEPS_PER_FRAME = 8;
+
+FramePacer::FramePacer(PacingMode mode, double rate)
+{
+    set_rate(rate);
+    set_mode(mode);
+}
+
+void FramePacer::set_mode(PacingMode mode)
+{
+    m_mode = mode;
+    m_previous = Clock::now();
+    m_deadline = m_previous;
+    m_accumulated = 0;
+}
+
+void FramePacer::set_rate(double rate)
+{
+    m_rate = rate > 0 ? rate : DEFAULT_FRAME_RATE;
+    m_period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / m_rate));
+}
+
+double FramePacer::begin_frame()
+{
+    if (m_mode == PacingMode::Fixed) {
+        wait_until(m_deadline);
+
+        // Step the deadline by whole periods so waiting errors don't add up, unless the frame
+        // ran late by more than a period, then start counting again from now
+        Clock::time_point now = Clock::now();
+        m_deadline = (now - m_deadline > m_period) ? now + m_period : m_deadline + m_period;
+    }
+
+    Clock::time_point now = Clock::now();
+    double delta = std::chrono::duration<double>(now - m_previous).count();
+    m_previous = now;
+
+    if (m_mode == PacingMode::FixedTimestep) {
+        m_accumulated = std::min(m_accumulated + delta, MAX_STEPS_PER_FRAME * get_timestep());
+    }
+    return delta;
+}
+
+int FramePacer::take_steps()
+{
+    int steps = m_accumulated / get_timestep();
+    m_accumulated -= steps * get_timestep();
+    return steps;
+}
+
+void FramePacer::wait_until(Clock::time_point deadline)
+{
+    if (deadline - Clock::now() > SPIN_TIME) {
+        std::this_thread::sleep_until(deadline - SPIN_TIME);
+    }
+    while (Clock::now() < deadline) {
+        std::this_thread::yield();
+    }
+}
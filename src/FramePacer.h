@@ -0,0 +1,44 @@
+#pragma once
+#include <chrono>
+
+// Frames per second targeted by PacingMode::Fixed, and simulation steps per second of
+// PacingMode::FixedTimestep, unless told otherwise
+constexpr double DEFAULT_FRAME_RATE = 30;
+
+enum class PacingMode {
+    Uncapped,     // frames start as soon as the previous one is done
+    Fixed,        // frames start at a fixed rate, waiting out the rest of each period
+    FixedTimestep // frames are uncapped, the simulation advances in steps of a fixed length
+};
+
+// Decides when frames start and how far the scene moves in each of them, timed by the
+// steady clock to well under a millisecond
+class FramePacer {
+public:
+    FramePacer(PacingMode mode = PacingMode::Fixed, double rate = DEFAULT_FRAME_RATE);
+
+    void set_mode(PacingMode mode);
+    PacingMode get_mode() { return m_mode; }
+    void set_rate(double rate);
+
+    // Called at the start of every frame: waits until the frame is due, then returns the
+    // seconds since the previous frame started
+    double begin_frame();
+
+    // Simulation steps due since the last call, each get_timestep() seconds long.
+    // Only PacingMode::FixedTimestep ever has any.
+    int take_steps();
+    double get_timestep() { return 1.0 / m_rate; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    void wait_until(Clock::time_point deadline);
+
+    PacingMode m_mode;
+    double m_rate;
+    Clock::duration m_period;
+    Clock::time_point m_previous; // start of the previous frame
+    Clock::time_point m_deadline; // when the next frame is due in PacingMode::Fixed
+    double m_accumulated = 0;     // simulation time not yet stepped in PacingMode::FixedTimestep
+};
@@ -2,6 +2,7 @@
 #include <cmath>
 
 #include "Framebuffer.h"
+#include "span.h"
 
 Framebuffer::Framebuffer(int width, int height)
 {
@@ -11,29 +12,190 @@ Framebuffer::Framebuffer(int width, int height)
     // Initialize render mode and triangle culling method
     set_render_method(RenderMethod::Textured);
     set_cull_method(CullMethod::Backface);
+    set_raster_method(RasterMethod::EdgeFunction);
 
     // Allocate the required memory in bytes to hold the color buffer and the z-buffer
     m_color.resize(m_width * m_height);
     m_depth.resize(m_width * m_height);
+
+    // One maximum per depth block, partial blocks at the right and bottom edges included
+    m_blocks_x = (m_width + DEPTH_BLOCK_SIZE - 1) / DEPTH_BLOCK_SIZE;
+    m_blocks_y = (m_height + DEPTH_BLOCK_SIZE - 1) / DEPTH_BLOCK_SIZE;
+    m_block_depth.resize(m_blocks_x * m_blocks_y);
+    m_block_dirty.resize(m_blocks_x * m_blocks_y);
+    m_block_stale.resize(m_blocks_x * m_blocks_y);
+    m_block_drawn.resize(m_blocks_x * m_blocks_y);
+
+    set_background(0xFF000000);
+    clear_color();
+    clear_depth();
+}
+
+Rect union_rect(const Rect& a, const Rect& b)
+{
+    if (a.x0 >= a.x1 || a.y0 >= a.y1) {
+        return b;
+    }
+    if (b.x0 >= b.x1 || b.y0 >= b.y1) {
+        return a;
+    }
+    return { std::min(a.x0, b.x0), std::min(a.y0, b.y0), std::max(a.x1, b.x1), std::max(a.y1, b.y1) };
+}
+
+const char* cull_method_name(CullMethod method)
+{
+    switch (method) {
+    case CullMethod::Backface:
+        return "backface";
+    case CullMethod::None:
+        break;
+    }
+    return "none";
+}
+
+const char* render_method_name(RenderMethod method)
+{
+    switch (method) {
+    case RenderMethod::Wire:
+        return "wire";
+    case RenderMethod::WireVertex:
+        return "wire_vertex";
+    case RenderMethod::FillTriangle:
+        return "fill_triangle";
+    case RenderMethod::FillTriangleWire:
+        return "fill_triangle_wire";
+    case RenderMethod::Textured:
+        return "textured";
+    case RenderMethod::TexturedWire:
+        break;
+    }
+    return "textured_wire";
+}
+
+// Build the plate the color buffer is cleared to: a solid color with the grid drawn over it
+void Framebuffer::set_background(uint32_t color)
+{
+    m_background.assign(m_width * m_height, color);
+    for (int y = 0; y < m_height; y += 10) {
+        for (int x = 0; x < m_width; x += 10) {
+            m_background[(m_width * y) + x] = 0xFF444444;
+        }
+    }
+
+    // The whole plate differs from what the color buffer holds
+    std::fill(m_block_drawn.begin(), m_block_drawn.end(), 1);
 }
 
-void Framebuffer::clear_color(uint32_t color)
+void Framebuffer::clear_color()
 {
-    for (int i = 0; i < m_width * m_height; i++) {
-        m_color[i] = color;
+    // Everything outside the blocks drawn into since the last clear still shows the plate
+    Rect drawn = get_drawn_rect();
+    for (int y = drawn.y0; y < drawn.y1; y++) {
+        int row = (m_width * y) + drawn.x0;
+        std::copy_n(&m_background[row], drawn.x1 - drawn.x0, &m_color[row]);
     }
+    std::fill(m_block_drawn.begin(), m_block_drawn.end(), 0);
+    m_changed = union_rect(m_changed, drawn);
+}
+
+// Bounding rectangle of the blocks drawn into since the last clear_color, empty if there are none
+Rect Framebuffer::get_drawn_rect()
+{
+    int min_x = m_blocks_x, min_y = m_blocks_y;
+    int max_x = -1, max_y = -1;
+    for (int block_y = 0; block_y < m_blocks_y; block_y++) {
+        const uint8_t* drawn = &m_block_drawn[m_blocks_x * block_y];
+        for (int block_x = 0; block_x < m_blocks_x; block_x++) {
+            if (drawn[block_x]) {
+                min_x = std::min(min_x, block_x);
+                max_x = std::max(max_x, block_x);
+                min_y = std::min(min_y, block_y);
+                max_y = block_y;
+            }
+        }
+    }
+    if (max_x < 0) {
+        return { 0, 0, 0, 0 };
+    }
+    return {
+        min_x * DEPTH_BLOCK_SIZE,
+        min_y * DEPTH_BLOCK_SIZE,
+        std::min((max_x + 1) * DEPTH_BLOCK_SIZE, m_width),
+        std::min((max_y + 1) * DEPTH_BLOCK_SIZE, m_height),
+    };
+}
+
+Rect Framebuffer::get_changed_rect()
+{
+    return union_rect(m_changed, get_drawn_rect());
+}
+
+void Framebuffer::clear_changed_rect()
+{
+    m_changed = { 0, 0, 0, 0 };
 }
 
 void Framebuffer::clear_depth()
 {
-    for (int i = 0; i < m_width * m_height; i++) {
-        m_depth[i] = 1.0;
+    // Nothing is written to the depth buffer itself here, see clear_stale_blocks
+    std::fill(m_block_depth.begin(), m_block_depth.end(), 1.0f);
+    std::fill(m_block_dirty.begin(), m_block_dirty.end(), 0);
+    std::fill(m_block_stale.begin(), m_block_stale.end(), 1);
+}
+
+/* Reset the depth of the blocks overlapping a rectangle that weren't drawn into since the last
+   clear_depth. Every run of neighbouring stale blocks in a block row is filled as one, so each
+   pixel row of the run is a single long fill.
+
+      blocks   [ drawn ][ stale ][ stale ][ drawn ][ stale ]
+      filled             <------------->            <----->   */
+void Framebuffer::clear_stale_blocks(const Rect& rect)
+{
+    int block_x0 = rect.x0 / DEPTH_BLOCK_SIZE;
+    int block_x1 = (rect.x1 - 1) / DEPTH_BLOCK_SIZE;
+    for (int block_y = rect.y0 / DEPTH_BLOCK_SIZE; block_y <= (rect.y1 - 1) / DEPTH_BLOCK_SIZE; block_y++) {
+        uint8_t* stale = &m_block_stale[m_blocks_x * block_y];
+        for (int block_x = block_x0; block_x <= block_x1; block_x++) {
+            if (!stale[block_x]) {
+                continue;
+            }
+            int run_end = block_x;
+            while (run_end + 1 <= block_x1 && stale[run_end + 1]) {
+                run_end++;
+            }
+            std::fill(stale + block_x, stale + run_end + 1, 0);
+
+            int x0 = block_x * DEPTH_BLOCK_SIZE;
+            int x1 = std::min((run_end + 1) * DEPTH_BLOCK_SIZE, m_width);
+            int y0 = block_y * DEPTH_BLOCK_SIZE;
+            int y1 = std::min(y0 + DEPTH_BLOCK_SIZE, m_height);
+            for (int y = y0; y < y1; y++) {
+                std::fill_n(&m_depth[(m_width * y) + x0], x1 - x0, 1.0f);
+            }
+            block_x = run_end;
+        }
+    }
+}
+
+bool Framebuffer::is_block_stale(int x, int y)
+{
+    return m_block_stale[(m_blocks_x * (y / DEPTH_BLOCK_SIZE)) + (x / DEPTH_BLOCK_SIZE)];
+}
+
+int Framebuffer::count_covered_pixels()
+{
+    int covered = 0;
+    for (int y = 0; y < m_height; y++) {
+        for (int x = 0; x < m_width; x++) {
+            covered += !is_block_stale(x, y) && m_depth[(m_width * y) + x] < 1.0f;
+        }
     }
+    return covered;
 }
 
 float Framebuffer::get_depth(int x, int y)
 {
-    if (x < 0 || x >= m_width || y < 0 || y >= m_height) {
+    if (x < 0 || x >= m_width || y < 0 || y >= m_height || is_block_stale(x, y)) {
         return 1.0;
     }
     return m_depth[(m_width * y) + x];
@@ -44,16 +206,124 @@ void Framebuffer::set_depth(int x, int y, float depth)
     if (x < 0 || x >= m_width || y < 0 || y >= m_height) {
         return;
     }
+    clear_stale_blocks({ x, y, x + 1, y + 1 });
     m_depth[(m_width * y) + x] = depth;
 }
 
-void Framebuffer::draw_grid()
+// Slack for the rounding of interpolated depths, so a block is only skipped when it is clearly hidden
+constexpr float DEPTH_BLOCK_EPSILON = 1e-5f;
+
+// Triangles with a smaller bounding box are depth tested pixel by pixel only. Refreshing the
+// blocks they touch would cost more than the pixels the test could save.
+constexpr int DEPTH_BLOCK_MIN_AREA = 4 * DEPTH_BLOCK_SIZE * DEPTH_BLOCK_SIZE;
+
+// True when nearest is behind every depth stored in a block. The block maximum is only
+// recomputed when a stale one can't already tell and the block was drawn into since.
+bool Framebuffer::is_block_hidden(int block_x, int block_y, float nearest)
 {
-    for (int y = 0; y < m_height; y += 10) {
-        for (int x = 0; x < m_width; x += 10) {
-            m_color[(m_width * y) + x] = 0xFF444444;
+    int block = (m_blocks_x * block_y) + block_x;
+    if (nearest >= m_block_depth[block]) {
+        return true;
+    }
+    if (m_block_dirty[block]) {
+        int x0 = block_x * DEPTH_BLOCK_SIZE;
+        int y0 = block_y * DEPTH_BLOCK_SIZE;
+        int x1 = std::min(x0 + DEPTH_BLOCK_SIZE, m_width);
+        int y1 = std::min(y0 + DEPTH_BLOCK_SIZE, m_height);
+        float farthest = m_depth[(m_width * y0) + x0];
+        for (int y = y0; y < y1; y++) {
+            const float* row = &m_depth[m_width * y];
+            for (int x = x0; x < x1; x++) {
+                farthest = std::max(farthest, row[x]);
+            }
         }
+        m_block_depth[block] = farthest;
+        m_block_dirty[block] = 0;
+        return nearest >= farthest;
     }
+    return false;
+}
+
+bool Framebuffer::should_test_depth_blocks(const Rect& bounds)
+{
+    return should_use_hierarchical_z() && (bounds.x1 - bounds.x0) * (bounds.y1 - bounds.y0) >= DEPTH_BLOCK_MIN_AREA;
+}
+
+void Framebuffer::mark_depth_blocks(const Rect& rect)
+{
+    for (int block_y = rect.y0 / DEPTH_BLOCK_SIZE; block_y <= (rect.y1 - 1) / DEPTH_BLOCK_SIZE; block_y++) {
+        for (int block_x = rect.x0 / DEPTH_BLOCK_SIZE; block_x <= (rect.x1 - 1) / DEPTH_BLOCK_SIZE; block_x++) {
+            m_block_dirty[(m_blocks_x * block_y) + block_x] = 1;
+            m_block_drawn[(m_blocks_x * block_y) + block_x] = 1;
+        }
+    }
+}
+
+// Pixel bounding box of a triangle inside the clip rectangle, empty when they don't overlap
+static Rect triangle_bounds(glm::vec4 a, glm::vec4 b, glm::vec4 c, const Rect& clip)
+{
+    return {
+        std::max(std::min({ (int)a.x, (int)b.x, (int)c.x }), clip.x0),
+        std::max(std::min({ (int)a.y, (int)b.y, (int)c.y }), clip.y0),
+        std::min(std::max({ (int)a.x, (int)b.x, (int)c.x }) + 1, clip.x1),
+        std::min(std::max({ (int)a.y, (int)b.y, (int)c.y }) + 1, clip.y1),
+    };
+}
+
+bool Framebuffer::is_triangle_hidden(glm::vec4 point_a, glm::vec4 point_b, glm::vec4 point_c, const Rect& clip)
+{
+    Rect bounds = triangle_bounds(point_a, point_b, point_c, clip);
+    if (bounds.x0 >= bounds.x1 || bounds.y0 >= bounds.y1 || !should_test_depth_blocks(bounds)) {
+        return false;
+    }
+
+    // 1/w is linear in screen space, so the nearest point of the triangle is one of its vertices
+    float nearest = 1.0f - std::max({ 1 / point_a.w, 1 / point_b.w, 1 / point_c.w }) - DEPTH_BLOCK_EPSILON;
+    for (int block_y = bounds.y0 / DEPTH_BLOCK_SIZE; block_y <= (bounds.y1 - 1) / DEPTH_BLOCK_SIZE; block_y++) {
+        for (int block_x = bounds.x0 / DEPTH_BLOCK_SIZE; block_x <= (bounds.x1 - 1) / DEPTH_BLOCK_SIZE; block_x++) {
+            if (!is_block_hidden(block_x, block_y, nearest)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* Hand the parts of a span starting at pixel (x, y) that may pass the depth test to draw, in
+   runs of consecutive blocks. A block is skipped when the nearest depth of the span inside it,
+   at one of its ends since 1/w is linear, is behind everything stored in the block. A span with
+   no hidden block is drawn whole and unchanged. Returns the pixels written. The blocks are left for the caller to mark once
+   the whole triangle is drawn, so the rows below don't refresh them over and over. */
+template<typename DrawSpan>
+int Framebuffer::draw_visible_runs(const Span& span, int x, int y, float max_reciprocal_w, DrawSpan draw)
+{
+    int written = 0;
+    int block_y = y / DEPTH_BLOCK_SIZE;
+    int run = -1; // first pixel of the current run of visible blocks
+    for (int offset = 0; offset < span.count;) {
+        int block_x = (x + offset) / DEPTH_BLOCK_SIZE;
+        int end = std::min(((block_x + 1) * DEPTH_BLOCK_SIZE) - x, span.count);
+
+        float first = span.reciprocal_w + span.reciprocal_w_dx * offset;
+        float last = span.reciprocal_w + span.reciprocal_w_dx * (end - 1);
+        float nearest = 1.0f - std::min(std::max(first, last), max_reciprocal_w) - DEPTH_BLOCK_EPSILON;
+        bool hidden = is_block_hidden(block_x, block_y, nearest);
+
+        if (hidden && run >= 0) {
+            Span visible = advance_span(span, run);
+            visible.count = offset - run;
+            written += draw(visible);
+            run = -1;
+        } else if (!hidden && run < 0) {
+            run = offset;
+        }
+        offset = end;
+    }
+
+    if (run >= 0) {
+        written += draw(advance_span(span, run));
+    }
+    return written;
 }
 
 void Framebuffer::draw_pixel(int x, int y, uint32_t color)
@@ -62,9 +332,19 @@ void Framebuffer::draw_pixel(int x, int y, uint32_t color)
         return;
     }
     m_color[(m_width * y) + x] = color;
+    m_block_drawn[(m_blocks_x * (y / DEPTH_BLOCK_SIZE)) + (x / DEPTH_BLOCK_SIZE)] = 1;
+}
+
+bool Framebuffer::draw_pixel(int x, int y, uint32_t color, const Rect& clip)
+{
+    if (x < clip.x0 || x >= clip.x1 || y < clip.y0 || y >= clip.y1) {
+        return false;
+    }
+    draw_pixel(x, y, color);
+    return true;
 }
 
-void Framebuffer::draw_line(int x0, int y0, int x1, int y1, uint32_t color)
+int Framebuffer::draw_line(int x0, int y0, int x1, int y1, uint32_t color, const Rect& clip)
 {
     int delta_x = (x1 - x0);
     int delta_y = (y1 - y0);
@@ -77,34 +357,39 @@ void Framebuffer::draw_line(int x0, int y0, int x1, int y1, uint32_t color)
     float current_x = x0;
     float current_y = y0;
 
+    int written = 0;
     for (int i = 0; i <= longest_side_length; i++) {
-        draw_pixel(round(current_x), round(current_y), color);
+        written += draw_pixel(round(current_x), round(current_y), color, clip);
         current_x += x_inc;
         current_y += y_inc;
     }
+    return written;
 }
 
-void Framebuffer::draw_rect(int x, int y, int width, int height, uint32_t color)
+int Framebuffer::draw_rect(int x, int y, int width, int height, uint32_t color, const Rect& clip)
 {
+    int written = 0;
     for (int i = 0; i < width; i++) {
         for (int j = 0; j < height; j++) {
             int current_x = x + i;
             int current_y = y + j;
-            draw_pixel(current_x, current_y, color);
+            written += draw_pixel(current_x, current_y, color, clip);
         }
     }
+    return written;
 }
 
 // Draw a triangle using three raw line calls
-void Framebuffer::draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color)
+int Framebuffer::draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color, const Rect& clip)
 {
-    draw_line(x0, y0, x1, y1, color);
-    draw_line(x1, y1, x2, y2, color);
-    draw_line(x2, y2, x0, y0, color);
+    int written = draw_line(x0, y0, x1, y1, color, clip);
+    written += draw_line(x1, y1, x2, y2, color, clip);
+    written += draw_line(x2, y2, x0, y0, color, clip);
+    return written;
 }
 
 // Function to draw a solid pixel at position (x,y) using depth interpolation
-void Framebuffer::draw_triangle_pixel(
+bool Framebuffer::draw_triangle_pixel(
     int x, int y, uint32_t color,
     glm::vec4 point_a, glm::vec4 point_b, glm::vec4 point_c)
 {
@@ -134,12 +419,14 @@ void Framebuffer::draw_triangle_pixel(
 
         // Update the z-buffer value with the 1/w of this current pixel
         set_depth(x, y, interpolated_reciprocal_w);
+        return true;
     }
+    return false;
 }
 
 // Function to draw the textured pixel at position (x,y) using depth interpolation
-void Framebuffer::draw_triangle_texel(
-    int x, int y, uint32_t* texture,
+bool Framebuffer::draw_triangle_texel(
+    int x, int y, const Texture& texture, int level,
     glm::vec4 point_a, glm::vec4 point_b, glm::vec4 point_c,
     glm::vec2 a_uv, glm::vec2 b_uv, glm::vec2 c_uv)
 {
@@ -171,21 +458,19 @@ void Framebuffer::draw_triangle_texel(
     interpolated_u /= interpolated_reciprocal_w;
     interpolated_v /= interpolated_reciprocal_w;
 
-    // Map the UV coordinate to the full texture width and height
-    int tex_x = abs((int)(interpolated_u * texture_width)) % texture_width;
-    int tex_y = abs((int)(interpolated_v * texture_height)) % texture_height;
-
     // Adjust 1/w so the pixels that are closer to the camera have smaller values
     interpolated_reciprocal_w = 1.0 - interpolated_reciprocal_w;
 
     // Only draw the pixel if the depth value is less than the one previously stored in the z-buffer
     if (interpolated_reciprocal_w < get_depth(x, y)) {
         // Draw a pixel at position (x,y) with the color that comes from the mapped texture
-        draw_pixel(x, y, texture[(texture_width * tex_y) + tex_x]);
+        draw_pixel(x, y, texture.sample(level, interpolated_u, interpolated_v));
 
         // Update the z-buffer value with the 1/w of this current pixel
         set_depth(x, y, interpolated_reciprocal_w);
+        return true;
     }
+    return false;
 }
 
 /* Draw a textured triangle based on a texture array of colors.
@@ -205,11 +490,11 @@ void Framebuffer::draw_triangle_texel(
                      \
                       v2
 */
-void Framebuffer::draw_textured_triangle(
+int Framebuffer::draw_textured_triangle(
     int x0, int y0, float z0, float w0, float u0, float v0,
     int x1, int y1, float z1, float w1, float u1, float v1,
     int x2, int y2, float z2, float w2, float u2, float v2,
-    uint32_t* texture)
+    const Texture& texture, const Rect& clip)
 {
     // We need to sort the vertices by y-coordinate ascending (y0 < y1 < y2)
     if (y0 > y1) {
@@ -250,6 +535,21 @@ void Framebuffer::draw_textured_triangle(
     glm::vec2 b_uv = { u1, v1 };
     glm::vec2 c_uv = { u2, v2 };
 
+    if (is_triangle_hidden(point_a, point_b, point_c, clip)) {
+        return 0;
+    }
+    Rect bounds = triangle_bounds(point_a, point_b, point_c, clip);
+    if (bounds.x0 >= bounds.x1 || bounds.y0 >= bounds.y1) {
+        return 0;
+    }
+    clear_stale_blocks(bounds);
+    mark_depth_blocks(bounds);
+    int written = 0;
+
+    // One mip level for the whole triangle, from its texel to pixel area ratio
+    float pixel_area = fabsf((float)(x1 - x0) * (y2 - y0) - (float)(x2 - x0) * (y1 - y0));
+    int level = texture.select_level(a_uv, b_uv, c_uv, pixel_area);
+
     // Render the upper part of the triangle (flat-bottom)
     float inv_slope_1 = 0;
     float inv_slope_2 = 0;
@@ -260,7 +560,7 @@ void Framebuffer::draw_textured_triangle(
         inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
 
     if (y1 - y0 != 0) {
-        for (int y = y0; y <= y1; y++) {
+        for (int y = std::max(y0, clip.y0); y <= std::min(y1, clip.y1 - 1); y++) {
             int x_start = x1 + (y - y1) * inv_slope_1;
             int x_end = x0 + (y - y0) * inv_slope_2;
 
@@ -268,9 +568,9 @@ void Framebuffer::draw_textured_triangle(
                 std::swap(x_start, x_end); // swap if x_start is to the right of x_end
             }
 
-            for (int x = x_start; x < x_end; x++) {
+            for (int x = std::max(x_start, clip.x0); x < std::min(x_end, clip.x1); x++) {
                 // Draw our pixel with the color that comes from the texture
-                draw_triangle_texel(x, y, texture, point_a, point_b, point_c, a_uv, b_uv, c_uv);
+                written += draw_triangle_texel(x, y, texture, level, point_a, point_b, point_c, a_uv, b_uv, c_uv);
             }
         }
     }
@@ -285,7 +585,7 @@ void Framebuffer::draw_textured_triangle(
         inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
 
     if (y2 - y1 != 0) {
-        for (int y = y1; y <= y2; y++) {
+        for (int y = std::max(y1, clip.y0); y <= std::min(y2, clip.y1 - 1); y++) {
             int x_start = x1 + (y - y1) * inv_slope_1;
             int x_end = x0 + (y - y0) * inv_slope_2;
 
@@ -293,12 +593,13 @@ void Framebuffer::draw_textured_triangle(
                 std::swap(x_start, x_end); // swap if x_start is to the right of x_end
             }
 
-            for (int x = x_start; x < x_end; x++) {
+            for (int x = std::max(x_start, clip.x0); x < std::min(x_end, clip.x1); x++) {
                 // Draw our pixel with the color that comes from the texture
-                draw_triangle_texel(x, y, texture, point_a, point_b, point_c, a_uv, b_uv, c_uv);
+                written += draw_triangle_texel(x, y, texture, level, point_a, point_b, point_c, a_uv, b_uv, c_uv);
             }
         }
     }
+    return written;
 }
 
 /* Draw a filled triangle with the flat-top/flat-bottom method
@@ -321,11 +622,11 @@ void Framebuffer::draw_textured_triangle(
                              \
                            (x2,y2)
 */
-void Framebuffer::draw_filled_triangle(
+int Framebuffer::draw_filled_triangle(
     int x0, int y0, float z0, float w0,
     int x1, int y1, float z1, float w1,
     int x2, int y2, float z2, float w2,
-    uint32_t color)
+    uint32_t color, const Rect& clip)
 {
     // We need to sort the vertices by y-coordinate ascending (y0 < y1 < y2)
     if (y0 > y1) {
@@ -352,6 +653,17 @@ void Framebuffer::draw_filled_triangle(
     glm::vec4 point_b = { (float)x1, (float)y1, z1, w1 };
     glm::vec4 point_c = { (float)x2, (float)y2, z2, w2 };
 
+    if (is_triangle_hidden(point_a, point_b, point_c, clip)) {
+        return 0;
+    }
+    Rect bounds = triangle_bounds(point_a, point_b, point_c, clip);
+    if (bounds.x0 >= bounds.x1 || bounds.y0 >= bounds.y1) {
+        return 0;
+    }
+    clear_stale_blocks(bounds);
+    mark_depth_blocks(bounds);
+    int written = 0;
+
     // Render the upper part of the triangle (flat-bottom)
     float inv_slope_1 = 0;
     float inv_slope_2 = 0;
@@ -362,7 +674,7 @@ void Framebuffer::draw_filled_triangle(
         inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
 
     if (y1 - y0 != 0) {
-        for (int y = y0; y <= y1; y++) {
+        for (int y = std::max(y0, clip.y0); y <= std::min(y1, clip.y1 - 1); y++) {
             int x_start = x1 + (y - y1) * inv_slope_1;
             int x_end = x0 + (y - y0) * inv_slope_2;
 
@@ -370,9 +682,9 @@ void Framebuffer::draw_filled_triangle(
                 std::swap(x_start, x_end); // swap if x_start is to the right of x_end
             }
 
-            for (int x = x_start; x < x_end; x++) {
+            for (int x = std::max(x_start, clip.x0); x < std::min(x_end, clip.x1); x++) {
                 // Draw our pixel with a solid color
-                draw_triangle_pixel(x, y, color, point_a, point_b, point_c);
+                written += draw_triangle_pixel(x, y, color, point_a, point_b, point_c);
             }
         }
     }
@@ -387,7 +699,7 @@ void Framebuffer::draw_filled_triangle(
         inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
 
     if (y2 - y1 != 0) {
-        for (int y = y1; y <= y2; y++) {
+        for (int y = std::max(y1, clip.y0); y <= std::min(y2, clip.y1 - 1); y++) {
             int x_start = x1 + (y - y1) * inv_slope_1;
             int x_end = x0 + (y - y0) * inv_slope_2;
 
@@ -395,12 +707,239 @@ void Framebuffer::draw_filled_triangle(
                 std::swap(x_start, x_end); // swap if x_start is to the right of x_end
             }
 
-            for (int x = x_start; x < x_end; x++) {
+            for (int x = std::max(x_start, clip.x0); x < std::min(x_end, clip.x1); x++) {
                 // Draw our pixel with a solid color
-                draw_triangle_pixel(x, y, color, point_a, point_b, point_c);
+                written += draw_triangle_pixel(x, y, color, point_a, point_b, point_c);
             }
         }
     }
+    return written;
+}
+
+/* Integer edge function of the directed edge a->b evaluated at point p.
+   It is twice the signed area of the triangle (a, b, p), positive when p lies to
+   the right of the edge in screen space (y grows downwards). Moving p one pixel
+   to the right or down changes it by a constant, so it can be stepped incrementally.
+
+        a--------->b
+         \  +   +  /
+          \   p   /
+           \  +  /
+            \   /
+              c
+*/
+static int edge_function(int ax, int ay, int bx, int by, int px, int py)
+{
+    return (bx - ax) * (py - ay) - (by - ay) * (px - ax);
+}
+
+// Top-left fill rule: pixels exactly on a top or left edge belong to the triangle, the others do not
+static int edge_bias(int ax, int ay, int bx, int by)
+{
+    bool is_top = (ay == by && bx > ax);
+    bool is_left = (by < ay);
+    return (is_top || is_left) ? 0 : -1;
+}
+
+// Per triangle setup of the three edge functions and their steps, shared by the edge rasterizers
+struct EdgeSetup {
+    // Pixel bounding box of the triangle inside the clip rectangle
+    int min_x, min_y, max_x, max_y;
+    // Edge function values at (min_x, min_y) with the fill rule bias applied
+    int w0_row, w1_row, w2_row;
+    // Edge function steps for one pixel in x and y
+    int w0_dx, w1_dx, w2_dx;
+    int w0_dy, w1_dy, w2_dy;
+    // Twice the triangle area, used to turn edge values into barycentric weights
+    float area;
+    // Unbiased edge values at (min_x, min_y) for attribute interpolation
+    float l0, l1, l2;
+};
+
+// Returns false when the triangle has no area or lies outside the clip rectangle.
+// Swaps b and c when needed so that the triangle always has a positive area.
+static bool setup_edges(glm::vec4& a, glm::vec4& b, glm::vec4& c, glm::vec2& b_uv, glm::vec2& c_uv, const Rect& clip, EdgeSetup& edges)
+{
+    int x0 = a.x, y0 = a.y;
+    int x1 = b.x, y1 = b.y;
+    int x2 = c.x, y2 = c.y;
+
+    int area = edge_function(x0, y0, x1, y1, x2, y2);
+    if (area == 0) {
+        return false;
+    }
+    if (area < 0) {
+        std::swap(b, c);
+        std::swap(b_uv, c_uv);
+        std::swap(x1, x2);
+        std::swap(y1, y2);
+        area = -area;
+    }
+
+    edges.min_x = std::max(std::min({ x0, x1, x2 }), clip.x0);
+    edges.min_y = std::max(std::min({ y0, y1, y2 }), clip.y0);
+    edges.max_x = std::min(std::max({ x0, x1, x2 }), clip.x1 - 1);
+    edges.max_y = std::min(std::max({ y0, y1, y2 }), clip.y1 - 1);
+    if (edges.min_x > edges.max_x || edges.min_y > edges.max_y) {
+        return false;
+    }
+
+    // Edge w0 is opposite vertex a, w1 opposite b and w2 opposite c
+    int w0 = edge_function(x1, y1, x2, y2, edges.min_x, edges.min_y);
+    int w1 = edge_function(x2, y2, x0, y0, edges.min_x, edges.min_y);
+    int w2 = edge_function(x0, y0, x1, y1, edges.min_x, edges.min_y);
+
+    edges.w0_row = w0 + edge_bias(x1, y1, x2, y2);
+    edges.w1_row = w1 + edge_bias(x2, y2, x0, y0);
+    edges.w2_row = w2 + edge_bias(x0, y0, x1, y1);
+
+    edges.w0_dx = y1 - y2;
+    edges.w1_dx = y2 - y0;
+    edges.w2_dx = y0 - y1;
+    edges.w0_dy = x2 - x1;
+    edges.w1_dy = x0 - x2;
+    edges.w2_dy = x1 - x0;
+
+    edges.area = area;
+    edges.l0 = w0;
+    edges.l1 = w1;
+    edges.l2 = w2;
+    return true;
+}
+
+// A screen space linear attribute: its value at the bounding box origin and its per pixel steps
+struct Gradient {
+    float value, dx, dy;
+};
+
+static Gradient setup_gradient(const EdgeSetup& edges, float fa, float fb, float fc)
+{
+    return {
+        (fa * edges.l0 + fb * edges.l1 + fc * edges.l2) / edges.area,
+        (fa * edges.w0_dx + fb * edges.w1_dx + fc * edges.w2_dx) / edges.area,
+        (fa * edges.w0_dy + fb * edges.w1_dy + fc * edges.w2_dy) / edges.area,
+    };
+}
+
+// Draw a solid triangle by walking its bounding box and testing the three edge functions per pixel
+int Framebuffer::draw_filled_triangle_edge(glm::vec4 point_a, glm::vec4 point_b, glm::vec4 point_c, uint32_t color, const Rect& clip)
+{
+    if (is_triangle_hidden(point_a, point_b, point_c, clip)) {
+        return 0;
+    }
+
+    glm::vec2 unused_b_uv, unused_c_uv;
+    EdgeSetup edges;
+    if (!setup_edges(point_a, point_b, point_c, unused_b_uv, unused_c_uv, clip, edges)) {
+        return 0;
+    }
+
+    // 1/w is linear in screen space, so it can be stepped like the edge functions
+    Gradient reciprocal_w = setup_gradient(edges, 1 / point_a.w, 1 / point_b.w, 1 / point_c.w);
+    float max_reciprocal_w = std::max({ 1 / point_a.w, 1 / point_b.w, 1 / point_c.w });
+    Rect bounds = { edges.min_x, edges.min_y, edges.max_x + 1, edges.max_y + 1 };
+    bool test_blocks = should_test_depth_blocks(bounds);
+    clear_stale_blocks(bounds);
+    int written = 0;
+
+    for (int y = edges.min_y; y <= edges.max_y; y++) {
+        int index = (m_width * y) + edges.min_x;
+        Span span = {
+            .color = &m_color[index],
+            .depth = &m_depth[index],
+            .count = edges.max_x - edges.min_x + 1,
+            .w0 = edges.w0_row,
+            .w1 = edges.w1_row,
+            .w2 = edges.w2_row,
+            .w0_dx = edges.w0_dx,
+            .w1_dx = edges.w1_dx,
+            .w2_dx = edges.w2_dx,
+            .reciprocal_w = reciprocal_w.value,
+            .reciprocal_w_dx = reciprocal_w.dx,
+            .u = 0,
+            .u_dx = 0,
+            .v = 0,
+            .v_dx = 0,
+        };
+        if (test_blocks) {
+            written += draw_visible_runs(span, edges.min_x, y, max_reciprocal_w, [&](const Span& run) { return draw_filled_span(run, color); });
+        } else {
+            written += draw_filled_span(span, color);
+        }
+
+        edges.w0_row += edges.w0_dy;
+        edges.w1_row += edges.w1_dy;
+        edges.w2_row += edges.w2_dy;
+        reciprocal_w.value += reciprocal_w.dy;
+    }
+    mark_depth_blocks(bounds);
+    return written;
+}
+
+// Draw a textured triangle with edge functions, stepping 1/w, u/w and v/w incrementally
+int Framebuffer::draw_textured_triangle_edge(glm::vec4 point_a, glm::vec4 point_b, glm::vec4 point_c, glm::vec2 a_uv, glm::vec2 b_uv, glm::vec2 c_uv, const Texture& texture, const Rect& clip)
+{
+    if (is_triangle_hidden(point_a, point_b, point_c, clip)) {
+        return 0;
+    }
+
+    EdgeSetup edges;
+    if (!setup_edges(point_a, point_b, point_c, b_uv, c_uv, clip, edges)) {
+        return 0;
+    }
+
+    // Flip the V component to account for inverted UV-coordinates (V grows downwards)
+    a_uv.y = 1.0 - a_uv.y;
+    b_uv.y = 1.0 - b_uv.y;
+    c_uv.y = 1.0 - c_uv.y;
+
+    // One mip level for the whole triangle, from its texel to pixel area ratio
+    int level = texture.select_level(a_uv, b_uv, c_uv, edges.area);
+
+    Gradient reciprocal_w = setup_gradient(edges, 1 / point_a.w, 1 / point_b.w, 1 / point_c.w);
+    Gradient u_over_w = setup_gradient(edges, a_uv.x / point_a.w, b_uv.x / point_b.w, c_uv.x / point_c.w);
+    Gradient v_over_w = setup_gradient(edges, a_uv.y / point_a.w, b_uv.y / point_b.w, c_uv.y / point_c.w);
+    float max_reciprocal_w = std::max({ 1 / point_a.w, 1 / point_b.w, 1 / point_c.w });
+    Rect bounds = { edges.min_x, edges.min_y, edges.max_x + 1, edges.max_y + 1 };
+    bool test_blocks = should_test_depth_blocks(bounds);
+    clear_stale_blocks(bounds);
+    int written = 0;
+
+    // Each row of the bounding box is shaded by the fastest span kernel the CPU supports
+    for (int y = edges.min_y; y <= edges.max_y; y++) {
+        int index = (m_width * y) + edges.min_x;
+        Span span = {
+            .color = &m_color[index],
+            .depth = &m_depth[index],
+            .count = edges.max_x - edges.min_x + 1,
+            .w0 = edges.w0_row,
+            .w1 = edges.w1_row,
+            .w2 = edges.w2_row,
+            .w0_dx = edges.w0_dx,
+            .w1_dx = edges.w1_dx,
+            .w2_dx = edges.w2_dx,
+            .reciprocal_w = reciprocal_w.value,
+            .reciprocal_w_dx = reciprocal_w.dx,
+            .u = u_over_w.value,
+            .u_dx = u_over_w.dx,
+            .v = v_over_w.value,
+            .v_dx = v_over_w.dx,
+        };
+        if (test_blocks) {
+            written += draw_visible_runs(span, edges.min_x, y, max_reciprocal_w, [&](const Span& run) { return draw_textured_span(run, texture, level); });
+        } else {
+            written += draw_textured_span(span, texture, level);
+        }
+
+        edges.w0_row += edges.w0_dy;
+        edges.w1_row += edges.w1_dy;
+        edges.w2_row += edges.w2_dy;
+        reciprocal_w.value += reciprocal_w.dy;
+        u_over_w.value += u_over_w.dy;
+        v_over_w.value += v_over_w.dy;
+    }
+    mark_depth_blocks(bounds);
+    return written;
 }
 
 void Framebuffer::set_render_method(RenderMethod method)
@@ -413,6 +952,36 @@ void Framebuffer::set_cull_method(CullMethod method)
     cull_method = method;
 }
 
+void Framebuffer::set_raster_method(RasterMethod method)
+{
+    raster_method = method;
+}
+
+void Framebuffer::set_clip_method(ClipMethod method)
+{
+    clip_method = method;
+}
+
+void Framebuffer::set_depth_method(DepthMethod method)
+{
+    depth_method = method;
+}
+
+void Framebuffer::set_sort_method(SortMethod method)
+{
+    sort_method = method;
+}
+
+void Framebuffer::copy_settings(const Framebuffer& other)
+{
+    render_method = other.render_method;
+    cull_method = other.cull_method;
+    raster_method = other.raster_method;
+    clip_method = other.clip_method;
+    depth_method = other.depth_method;
+    sort_method = other.sort_method;
+}
+
 bool Framebuffer::should_render_wire()
 {
     return render_method == RenderMethod::Wire || render_method == RenderMethod::WireVertex || render_method == RenderMethod::FillTriangleWire || render_method == RenderMethod::TexturedWire;
@@ -438,6 +1007,36 @@ bool Framebuffer::should_cull_backface()
     return cull_method == CullMethod::Backface;
 }
 
+bool Framebuffer::should_use_edge_functions()
+{
+    return raster_method == RasterMethod::EdgeFunction;
+}
+
+bool Framebuffer::should_clip_homogeneous()
+{
+    return clip_method == ClipMethod::Homogeneous || clip_method == ClipMethod::GuardBand;
+}
+
+bool Framebuffer::should_use_guard_band()
+{
+    return clip_method == ClipMethod::GuardBand;
+}
+
+bool Framebuffer::should_use_hierarchical_z()
+{
+    return depth_method == DepthMethod::HierarchicalZ;
+}
+
+bool Framebuffer::should_sort_front_to_back()
+{
+    return sort_method == SortMethod::FrontToBack;
+}
+
+bool Framebuffer::should_sort_back_to_front()
+{
+    return sort_method == SortMethod::BackToFront;
+}
+
 /* Return the barycentric weights alpha, beta, and gamma for point p
 
             A
@@ -2,6 +2,7 @@
 #include <cstdint>
 #include <vector>
 
+#include "span.h"
 #include "texture.h"
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
@@ -21,47 +22,157 @@ enum class RenderMethod {
     TexturedWire
 };
 
+enum class RasterMethod {
+    Scanline,
+    EdgeFunction
+};
+
+enum class ClipMethod {
+    ViewFrustum,
+    Homogeneous,
+    GuardBand
+};
+
+enum class DepthMethod {
+    ZBuffer,
+    HierarchicalZ
+};
+
+// Order the triangles of a frame are rasterized in, by depth or as submitted
+enum class SortMethod {
+    None,
+    FrontToBack,
+    BackToFront
+};
+
+// Edge length in pixels of the square blocks the hierarchical depth buffer keeps a maximum for
+constexpr int DEPTH_BLOCK_SIZE = 8;
+
+// Axis aligned pixel rectangle, the max corner is exclusive
+struct Rect {
+    int x0, y0;
+    int x1, y1;
+};
+
+// Smallest rectangle holding both, where an empty rectangle holds nothing
+Rect union_rect(const Rect& a, const Rect& b);
+
+// Lower case names of the methods, as the benchmark reports them
+const char* cull_method_name(CullMethod method);
+const char* render_method_name(RenderMethod method);
+
 glm::vec3 barycentric_weights(glm::vec2 a, glm::vec2 b, glm::vec2 c, glm::vec2 p);
 
 class Framebuffer {
 public:
     Framebuffer(int width, int height);
 
-    std::vector<uint32_t> get_color_buffer() { return m_color; };
+    // Read only view of the color buffer, valid until the framebuffer is destroyed
+    const std::vector<uint32_t>& get_color_buffer() { return m_color; };
+
+    int get_width() { return m_width; }
+    int get_height() { return m_height; }
+    Rect get_bounds() { return { 0, 0, m_width, m_height }; }
 
     void render(void);
 
-    void clear_color(uint32_t color);
+    // The color buffer is cleared by copying a prebuilt background plate over the area drawn into
+    // since the last clear, the rest of it still holds the plate
+    void set_background(uint32_t color);
+    void clear_color();
+
+    // Area of the color buffer that changed since clear_changed_rect, restored by a clear or drawn into.
+    // Displays that only upload this call clear_changed_rect once they did.
+    Rect get_changed_rect();
+    void clear_changed_rect();
+    // Lazy: a block's depth is only reset once a triangle reaches it, blocks left empty are never written
     void clear_depth();
 
+    // Number of pixels holding a depth written since the last clear
+    int count_covered_pixels();
+
     float get_depth(int x, int y);
     void set_depth(int x, int y, float depth);
 
-    void draw_grid(void);
     void draw_pixel(int x, int y, uint32_t color);
-    void draw_line(int x0, int y0, int x1, int y1, uint32_t color);
-    void draw_rect(int x, int y, int width, int height, uint32_t color);
 
-    void draw_triangle_pixel(int x, int y, uint32_t color, glm::vec4 point_a, glm::vec4 point_b, glm::vec4 point_c);
-    void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color);
-    void draw_filled_triangle(int x0, int y0, float z0, float w0, int x1, int y1, float z1, float w1, int x2, int y2, float z2, float w2, uint32_t color);
-    void draw_textured_triangle(int x0, int y0, float z0, float w0, float u0, float v0, int x1, int y1, float z1, float w1, float u1, float v1, int x2, int y2, float z2, float w2, float u2, float v2, uint32_t* texture);
-    void draw_triangle_texel(int x, int y, uint32_t* texture, glm::vec4 point_a, glm::vec4 point_b, glm::vec4 point_c, glm::vec2 a_uv, glm::vec2 b_uv, glm::vec2 c_uv);
+    // Clipped drawing only touches pixels inside the clip rectangle and returns the number of pixels written
+    bool draw_pixel(int x, int y, uint32_t color, const Rect& clip);
+    int draw_line(int x0, int y0, int x1, int y1, uint32_t color, const Rect& clip);
+    int draw_rect(int x, int y, int width, int height, uint32_t color, const Rect& clip);
+
+    // The filled and textured triangles only count the pixels that passed the depth test
+    bool draw_triangle_pixel(int x, int y, uint32_t color, glm::vec4 point_a, glm::vec4 point_b, glm::vec4 point_c);
+    int draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color, const Rect& clip);
+    int draw_filled_triangle(int x0, int y0, float z0, float w0, int x1, int y1, float z1, float w1, int x2, int y2, float z2, float w2, uint32_t color, const Rect& clip);
+    int draw_textured_triangle(int x0, int y0, float z0, float w0, float u0, float v0, int x1, int y1, float z1, float w1, float u1, float v1, int x2, int y2, float z2, float w2, float u2, float v2, const Texture& texture, const Rect& clip);
+    bool draw_triangle_texel(int x, int y, const Texture& texture, int level, glm::vec4 point_a, glm::vec4 point_b, glm::vec4 point_c, glm::vec2 a_uv, glm::vec2 b_uv, glm::vec2 c_uv);
+
+    // Bounding box rasterizers driven by incremental edge functions
+    int draw_filled_triangle_edge(glm::vec4 point_a, glm::vec4 point_b, glm::vec4 point_c, uint32_t color, const Rect& clip);
+    int draw_textured_triangle_edge(glm::vec4 point_a, glm::vec4 point_b, glm::vec4 point_c, glm::vec2 a_uv, glm::vec2 b_uv, glm::vec2 c_uv, const Texture& texture, const Rect& clip);
+
+    // Conservative depth test of a whole triangle against the farthest depth stored in each block
+    bool is_triangle_hidden(glm::vec4 point_a, glm::vec4 point_b, glm::vec4 point_c, const Rect& clip);
+    // Flag the depth and color of the blocks overlapping a rectangle as drawn into
+    void mark_depth_blocks(const Rect& rect);
 
     RenderMethod render_method = RenderMethod::Textured;
     CullMethod cull_method = CullMethod::Backface;
+    RasterMethod raster_method = RasterMethod::EdgeFunction;
+    ClipMethod clip_method = ClipMethod::GuardBand;
+    DepthMethod depth_method = DepthMethod::HierarchicalZ;
+    SortMethod sort_method = SortMethod::None;
     void set_render_method(RenderMethod method);
     void set_cull_method(CullMethod method);
+    void set_raster_method(RasterMethod method);
+    void set_clip_method(ClipMethod method);
+    void set_depth_method(DepthMethod method);
+    void set_sort_method(SortMethod method);
+
+    // Take over every render method of another framebuffer
+    void copy_settings(const Framebuffer& other);
 
     bool should_render_wire(void);
     bool should_render_wire_vertex(void);
     bool should_render_textured_triangle(void);
     bool should_render_filled_triangle(void);
     bool should_cull_backface(void);
+    bool should_use_edge_functions(void);
+    bool should_clip_homogeneous(void);
+    bool should_use_guard_band(void);
+    bool should_use_hierarchical_z(void);
+    bool should_sort_front_to_back(void);
+    bool should_sort_back_to_front(void);
 
 private:
     int m_height;
     int m_width;
     std::vector<uint32_t> m_color;
     std::vector<float> m_depth;
+    std::vector<uint32_t> m_background;
+
+    // Blocks whose color was drawn into since the last clear_color, at depth block granularity
+    Rect get_drawn_rect();
+    std::vector<uint8_t> m_block_drawn;
+    Rect m_changed = { 0, 0, 0, 0 };
+
+    // Blocks whose depth still holds an earlier frame and reads as cleared to 1.0
+    void clear_stale_blocks(const Rect& rect);
+    bool is_block_stale(int x, int y);
+    std::vector<uint8_t> m_block_stale;
+
+    /* Hierarchical depth: the farthest depth stored in every 8x8 block of the depth buffer.
+       Depth writes only ever bring values closer, so a block maximum that wasn't recomputed
+       after a write is still a safe upper bound. Blocks drawn into are flagged and their
+       maximum refreshed the next time a test needs it. Blocks never straddle rasterizer
+       tiles, so every block is only touched by one thread. */
+    bool is_block_hidden(int block_x, int block_y, float nearest);
+    bool should_test_depth_blocks(const Rect& bounds);
+    template<typename DrawSpan>
+    int draw_visible_runs(const Span& span, int x, int y, float max_reciprocal_w, DrawSpan draw);
+    int m_blocks_x;
+    int m_blocks_y;
+    std::vector<float> m_block_depth;
+    std::vector<uint8_t> m_block_dirty;
 };
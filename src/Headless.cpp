@@ -0,0 +1,65 @@
+#include <stdio.h>
+
+#include "Headless.h"
+
+Headless::Headless(Framebuffer* fb, int width, int height)
+    : Display(fb, width, height)
+{
+}
+
+void Headless::render()
+{
+    switch (m_output) {
+    case HeadlessOutput::None:
+        break;
+    case HeadlessOutput::Memory:
+        // Assigning reuses the capacity of the previous frame, so this never reallocates
+        m_frame = m_fb->get_color_buffer();
+        break;
+    case HeadlessOutput::Disk: {
+        char filename[32];
+        snprintf(filename, sizeof(filename), "frame_%05d.ppm", m_frame_count);
+        if (!write_ppm(m_dump_directory + "/" + filename)) {
+            fprintf(stderr, "Error writing frame %d to %s.\n", m_frame_count, m_dump_directory.c_str());
+        }
+        break;
+    }
+    }
+    m_frame_count++;
+}
+
+// There is no input device attached, so there are never any events to handle
+bool Headless::poll_event(SDL_Event*)
+{
+    return false;
+}
+
+// Nothing to decorate without a window
+void Headless::set_title(std::string)
+{
+}
+
+// Write the color buffer as a binary PPM, converting from the RGBA32 byte order used by SDL
+bool Headless::write_ppm(std::string filename)
+{
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    auto& data = m_fb->get_color_buffer();
+    std::vector<uint8_t> row(m_width * 3);
+
+    fprintf(file, "P6\n%d %d\n255\n", m_width, m_height);
+    for (int y = 0; y < m_height; y++) {
+        for (int x = 0; x < m_width; x++) {
+            uint32_t color = data[(m_width * y) + x];
+            row[x * 3 + 0] = color & 0xFF;
+            row[x * 3 + 1] = (color >> 8) & 0xFF;
+            row[x * 3 + 2] = (color >> 16) & 0xFF;
+        }
+        fwrite(&row[0], 1, row.size(), file);
+    }
+
+    return fclose(file) == 0;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Display.h"
+#include "Framebuffer.h"
+
+// Where the headless display sends each finished frame
+enum class HeadlessOutput {
+    None,
+    Memory,
+    Disk
+};
+
+// Offscreen display that never touches SDL video, used on machines without a screen
+class Headless : public Display {
+public:
+    Headless(Framebuffer* fb, int width, int height);
+
+    void render() override;
+    bool poll_event(SDL_Event* event) override;
+    void set_title(std::string title) override;
+
+    void set_output(HeadlessOutput output) { m_output = output; }
+    void set_dump_directory(std::string directory) { m_dump_directory = directory; }
+
+    // The last presented frame when the output is HeadlessOutput::Memory
+    const std::vector<uint32_t>& get_frame() { return m_frame; }
+    int get_frame_count() { return m_frame_count; }
+
+private:
+    bool write_ppm(std::string filename);
+
+    HeadlessOutput m_output = HeadlessOutput::None;
+    std::string m_dump_directory = ".";
+    std::vector<uint32_t> m_frame;
+    int m_frame_count = 0;
+};
@@ -0,0 +1,39 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "MappedFile.h"
+
+MappedFile::MappedFile(std::string filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0) {
+        m_opened = true;
+        m_size = info.st_size;
+        // Mapping an empty file fails, an empty file is simply an empty range
+        if (m_size > 0) {
+            void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                m_opened = false;
+                m_size = 0;
+            } else {
+                m_data = static_cast<const char*>(data);
+                madvise(data, m_size, MADV_SEQUENTIAL);
+            }
+        }
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data) {
+        munmap((void*)m_data, m_size);
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// Read only memory mapping of a whole file, unmapped when destroyed
+class MappedFile {
+public:
+    MappedFile(std::string filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool is_open() { return m_opened; }
+    const char* data() { return m_data; }
+    size_t size() { return m_size; }
+
+private:
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    bool m_opened = false;
+};
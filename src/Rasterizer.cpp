@@ -0,0 +1,233 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <numeric>
+
+#include "Rasterizer.h"
+
+// Pixels a triangle may reach beyond its vertices (the 6x6 vertex markers and rounding)
+constexpr float BIN_MARGIN = 4;
+
+Rasterizer::Rasterizer(Framebuffer* fb, ThreadPool* pool)
+    : m_fb(fb)
+    , m_pool(pool)
+{
+    m_tiles_x = (m_fb->get_width() + TILE_SIZE - 1) / TILE_SIZE;
+    m_tiles_y = (m_fb->get_height() + TILE_SIZE - 1) / TILE_SIZE;
+    m_bins.resize(m_tiles_x * m_tiles_y);
+    m_tile_written.resize(m_tiles_x * m_tiles_y);
+}
+
+void Rasterizer::draw(const TriangleArena& triangles, const Texture* texture)
+{
+    m_order.clear();
+    if (m_fb->should_sort_front_to_back() || m_fb->should_sort_back_to_front()) {
+        sort_triangles(triangles, m_fb->should_sort_front_to_back());
+    }
+    bin_triangles(triangles);
+
+    m_pool->parallel_for(m_bins.size(), [&](size_t tile) {
+        m_tile_written[tile] = draw_tile(tile, triangles, texture);
+    });
+}
+
+uint64_t Rasterizer::get_pixels_written()
+{
+    return std::accumulate(m_tile_written.begin(), m_tile_written.end(), (uint64_t)0,
+        [](uint64_t sum, const TilePixels& tile) { return sum + tile.shaded + tile.wire; });
+}
+
+uint64_t Rasterizer::get_shaded_pixels()
+{
+    return std::accumulate(m_tile_written.begin(), m_tile_written.end(), (uint64_t)0,
+        [](uint64_t sum, const TilePixels& tile) { return sum + tile.shaded; });
+}
+
+/* Order the triangles by depth with a least significant digit radix sort, 8 bits per pass.
+   Front to back sorts on the nearest vertex so the depth test rejects as much as possible
+   of what comes after, back to front on the farthest one. The w of every vertex is positive
+   after clipping, and positive floats order the same as their bit patterns, so the bits
+   serve as the key directly and inverted for the descending order. The sort is stable,
+   triangles at the same depth keep their submission order.
+
+      key   [ digit 3 | digit 2 | digit 1 | digit 0 ]
+      pass       4         3         2         1
+*/
+void Rasterizer::sort_triangles(const TriangleArena& triangles, bool front_to_back)
+{
+    size_t count = triangles.size();
+    m_order.resize(count);
+    m_keys.resize(count);
+    m_sorted_order.resize(count);
+    m_sorted_keys.resize(count);
+    if (count == 0) {
+        return;
+    }
+
+    const float* w0 = triangles.w[0].data();
+    const float* w1 = triangles.w[1].data();
+    const float* w2 = triangles.w[2].data();
+
+    // Histograms of all four digits are counted in the same pass that builds the keys
+    uint32_t histograms[4][256] = {};
+    for (size_t i = 0; i < count; i++) {
+        uint32_t key;
+        if (front_to_back) {
+            key = std::bit_cast<uint32_t>(std::min({ w0[i], w1[i], w2[i] }));
+        } else {
+            key = ~std::bit_cast<uint32_t>(std::max({ w0[i], w1[i], w2[i] }));
+        }
+        m_keys[i] = key;
+        m_order[i] = i;
+        for (int digit = 0; digit < 4; digit++) {
+            histograms[digit][(key >> (digit * 8)) & 0xFF]++;
+        }
+    }
+
+    for (int digit = 0; digit < 4; digit++) {
+        int shift = digit * 8;
+        uint32_t* histogram = histograms[digit];
+
+        // Nothing moves when every key has the same digit, as the exponent bytes often do
+        if (histogram[(m_keys[0] >> shift) & 0xFF] == count) {
+            continue;
+        }
+
+        // Turn the counts into the first output position of every digit value
+        uint32_t offset = 0;
+        for (int value = 0; value < 256; value++) {
+            uint32_t digit_count = histogram[value];
+            histogram[value] = offset;
+            offset += digit_count;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            uint32_t position = histogram[(m_keys[i] >> shift) & 0xFF]++;
+            m_sorted_keys[position] = m_keys[i];
+            m_sorted_order[position] = m_order[i];
+        }
+        m_keys.swap(m_sorted_keys);
+        m_order.swap(m_sorted_order);
+    }
+}
+
+// Add every triangle to the bin of each tile overlapped by its bounding box
+void Rasterizer::bin_triangles(const TriangleArena& triangles)
+{
+    for (auto& bin : m_bins) {
+        bin.clear();
+    }
+
+    float max_x = m_fb->get_width() - 1;
+    float max_y = m_fb->get_height() - 1;
+
+    // Binning only needs the screen positions, which sit in their own contiguous arrays
+    const float* x0 = triangles.x[0].data();
+    const float* x1 = triangles.x[1].data();
+    const float* x2 = triangles.x[2].data();
+    const float* y0 = triangles.y[0].data();
+    const float* y1 = triangles.y[1].data();
+    const float* y2 = triangles.y[2].data();
+
+    for (size_t n = 0; n < triangles.size(); n++) {
+        size_t i = m_order.empty() ? n : m_order[n];
+        float min_tx = std::min({ x0[i], x1[i], x2[i] }) - BIN_MARGIN;
+        float min_ty = std::min({ y0[i], y1[i], y2[i] }) - BIN_MARGIN;
+        float max_tx = std::max({ x0[i], x1[i], x2[i] }) + BIN_MARGIN;
+        float max_ty = std::max({ y0[i], y1[i], y2[i] }) + BIN_MARGIN;
+
+        // Skip triangles that are entirely off screen
+        if (max_tx < 0 || max_ty < 0 || min_tx > max_x || min_ty > max_y) {
+            continue;
+        }
+
+        int tile_x0 = std::clamp(min_tx, 0.0f, max_x) / TILE_SIZE;
+        int tile_y0 = std::clamp(min_ty, 0.0f, max_y) / TILE_SIZE;
+        int tile_x1 = std::clamp(max_tx, 0.0f, max_x) / TILE_SIZE;
+        int tile_y1 = std::clamp(max_ty, 0.0f, max_y) / TILE_SIZE;
+
+        for (int ty = tile_y0; ty <= tile_y1; ty++) {
+            for (int tx = tile_x0; tx <= tile_x1; tx++) {
+                m_bins[(m_tiles_x * ty) + tx].push_back(i);
+            }
+        }
+    }
+}
+
+// Draw all the triangles binned into one tile, clipped to the tile rectangle.
+// The wireframe and vertex markers have no depth, so they are drawn in passes of their
+// own over all the filled triangles, the same whatever order the triangles come in.
+// Returns the number of pixels written.
+TilePixels Rasterizer::draw_tile(int tile, const TriangleArena& triangles, const Texture* texture)
+{
+    int tile_x = (tile % m_tiles_x) * TILE_SIZE;
+    int tile_y = (tile / m_tiles_x) * TILE_SIZE;
+    Rect clip = {
+        tile_x,
+        tile_y,
+        std::min(tile_x + TILE_SIZE, m_fb->get_width()),
+        std::min(tile_y + TILE_SIZE, m_fb->get_height()),
+    };
+
+    TilePixels written;
+    for (auto index : m_bins[tile]) {
+        glm::vec4 a = triangles.point(index, 0);
+        glm::vec4 b = triangles.point(index, 1);
+        glm::vec4 c = triangles.point(index, 2);
+        uint32_t color = triangles.color[index];
+
+        // Draw filled triangle
+        if (m_fb->should_render_filled_triangle() && m_fb->should_use_edge_functions()) {
+            written.shaded += m_fb->draw_filled_triangle_edge(a, b, c, color, clip);
+        } else if (m_fb->should_render_filled_triangle()) {
+            written.shaded += m_fb->draw_filled_triangle(
+                a.x, a.y, a.z, a.w, // vertex A
+                b.x, b.y, b.z, b.w, // vertex B
+                c.x, c.y, c.z, c.w, // vertex C
+                color, clip);
+        }
+
+        // Draw textured triangle
+        if (m_fb->should_render_textured_triangle()) {
+            glm::vec2 a_uv = triangles.uv(index, 0);
+            glm::vec2 b_uv = triangles.uv(index, 1);
+            glm::vec2 c_uv = triangles.uv(index, 2);
+            if (m_fb->should_use_edge_functions()) {
+                written.shaded += m_fb->draw_textured_triangle_edge(a, b, c, a_uv, b_uv, c_uv, *texture, clip);
+            } else {
+                written.shaded += m_fb->draw_textured_triangle(
+                    a.x, a.y, a.z, a.w, a_uv.x, a_uv.y, // vertex A
+                    b.x, b.y, b.z, b.w, b_uv.x, b_uv.y, // vertex B
+                    c.x, c.y, c.z, c.w, c_uv.x, c_uv.y, // vertex C
+                    *texture, clip);
+            }
+        }
+    }
+
+    // Draw triangle wireframe
+    if (m_fb->should_render_wire()) {
+        for (auto index : m_bins[tile]) {
+            glm::vec4 a = triangles.point(index, 0);
+            glm::vec4 b = triangles.point(index, 1);
+            glm::vec4 c = triangles.point(index, 2);
+            written.wire += m_fb->draw_triangle(
+                a.x, a.y, // vertex A
+                b.x, b.y, // vertex B
+                c.x, c.y, // vertex C
+                0xFFFFFFFF, clip);
+        }
+    }
+
+    // Draw triangle vertex points
+    if (m_fb->should_render_wire_vertex()) {
+        for (auto index : m_bins[tile]) {
+            glm::vec4 a = triangles.point(index, 0);
+            glm::vec4 b = triangles.point(index, 1);
+            glm::vec4 c = triangles.point(index, 2);
+            written.wire += m_fb->draw_rect(a.x - 3, a.y - 3, 6, 6, 0xFF0000FF, clip); // vertex A
+            written.wire += m_fb->draw_rect(b.x - 3, b.y - 3, 6, 6, 0xFF0000FF, clip); // vertex B
+            written.wire += m_fb->draw_rect(c.x - 3, c.y - 3, 6, 6, 0xFF0000FF, clip); // vertex C
+        }
+    }
+    return written;
+}
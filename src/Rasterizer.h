@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Framebuffer.h"
+#include "ThreadPool.h"
+#include "TriangleArena.h"
+
+// Edge length in pixels of the square screen tiles triangles are binned into
+constexpr int TILE_SIZE = 64;
+static_assert(TILE_SIZE % DEPTH_BLOCK_SIZE == 0, "depth blocks must not straddle tiles");
+
+// Pixels written while drawing one tile, by the depth tested triangles and by the wireframe and vertex markers
+struct TilePixels {
+    uint64_t shaded = 0;
+    uint64_t wire = 0;
+};
+
+// Bins screen space triangles into tiles and rasterizes the tiles in parallel.
+// Each tile only ever writes its own pixels, so the workers never need a lock.
+class Rasterizer {
+public:
+    Rasterizer(Framebuffer* fb, ThreadPool* pool);
+
+    void draw(const TriangleArena& triangles, const Texture* texture);
+
+    // Pixels written by the last draw, counting every time a pixel was drawn over again
+    uint64_t get_pixels_written();
+    // Only those written by filled and textured triangles, which all passed the depth test
+    uint64_t get_shaded_pixels();
+
+private:
+    void sort_triangles(const TriangleArena& triangles, bool front_to_back);
+    void bin_triangles(const TriangleArena& triangles);
+    TilePixels draw_tile(int tile, const TriangleArena& triangles, const Texture* texture);
+
+    Framebuffer* m_fb;
+    ThreadPool* m_pool;
+
+    int m_tiles_x;
+    int m_tiles_y;
+
+    // Indices into the triangle list in the order they are drawn, empty for submission order
+    std::vector<uint32_t> m_order;
+    // Sort keys and the buffers the radix sort passes scatter into
+    std::vector<uint32_t> m_keys;
+    std::vector<uint32_t> m_sorted_keys;
+    std::vector<uint32_t> m_sorted_order;
+
+    // Indices into the triangle list for every tile, in drawing order
+    std::vector<std::vector<uint32_t>> m_bins;
+
+    // Pixels written in every tile during the last draw
+    std::vector<TilePixels> m_tile_written;
+};
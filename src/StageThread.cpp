@@ -0,0 +1,53 @@
+#include "StageThread.h"
+
+StageThread::StageThread()
+{
+    m_thread = std::thread(&StageThread::worker_loop, this);
+}
+
+StageThread::~StageThread()
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+void StageThread::start(std::function<void()> job)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [&] { return !m_busy; });
+        m_job = std::move(job);
+        m_busy = true;
+    }
+    m_wake.notify_one();
+}
+
+void StageThread::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [&] { return !m_busy; });
+}
+
+void StageThread::worker_loop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_wake.wait(lock, [&] { return m_stop || m_busy; });
+        if (m_stop) {
+            return;
+        }
+
+        lock.unlock();
+        m_job();
+        lock.lock();
+
+        m_job = nullptr;
+        m_busy = false;
+        m_done.notify_all();
+    }
+}
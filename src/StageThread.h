@@ -0,0 +1,30 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// A thread of its own for one stage of the frame pipeline, running one job at a time.
+// start() hands over the next job and returns straight away, wait() blocks until it is done.
+// Unlike the ThreadPool the caller never takes part, it goes on with a stage of its own.
+class StageThread {
+public:
+    StageThread();
+    ~StageThread();
+
+    // Waits for the job already running, if any, before handing over the next one
+    void start(std::function<void()> job);
+    // Returns at once when no job was started
+    void wait();
+
+private:
+    void worker_loop();
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    std::function<void()> m_job;
+    bool m_busy = false;
+    bool m_stop = false;
+};
@@ -0,0 +1,80 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned thread_count)
+{
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+    for (unsigned i = 1; i < thread_count; i++) {
+        m_workers.emplace_back(&ThreadPool::worker_loop, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::run(size_t count, void (*invoke)(void*, size_t), void* context)
+{
+    if (count == 0) {
+        return;
+    }
+
+    // Only one job runs at a time, callers from other threads wait their turn
+    std::lock_guard<std::mutex> run_lock(m_run_mutex);
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        // Workers that woke up late for the previous job may still be looking at it
+        m_done.wait(lock, [&] { return m_active == 0; });
+        m_invoke = invoke;
+        m_context = context;
+        m_count = count;
+        m_next = 0;
+        m_generation++;
+    }
+    m_wake.notify_all();
+
+    work();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [&] { return m_active == 0; });
+}
+
+// Grab indices from the shared counter until the job is exhausted
+void ThreadPool::work()
+{
+    for (size_t index = m_next++; index < m_count; index = m_next++) {
+        m_invoke(m_context, index);
+    }
+}
+
+void ThreadPool::worker_loop()
+{
+    size_t seen_generation = 0;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_wake.wait(lock, [&] { return m_stop || m_generation != seen_generation; });
+        if (m_stop) {
+            return;
+        }
+        seen_generation = m_generation;
+        m_active++;
+
+        lock.unlock();
+        work();
+        lock.lock();
+
+        if (--m_active == 0) {
+            m_done.notify_all();
+        }
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fork-join pool of worker threads. The calling thread always takes part in the work,
+// so a pool of one thread simply runs everything inline.
+class ThreadPool {
+public:
+    ThreadPool(unsigned thread_count = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    unsigned size() { return m_workers.size() + 1; }
+
+    // Call fn(i) for every i in [0, count) spread across the pool, returns when all calls are done
+    template<typename F>
+    void parallel_for(size_t count, F&& fn)
+    {
+        auto invoke = [](void* context, size_t index) { (*static_cast<F*>(context))(index); };
+        run(count, invoke, &fn);
+    }
+
+private:
+    void run(size_t count, void (*invoke)(void*, size_t), void* context);
+    void work();
+    void worker_loop();
+
+    std::vector<std::thread> m_workers;
+    std::mutex m_run_mutex;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    bool m_stop = false;
+    unsigned m_active = 0;
+    size_t m_generation = 0;
+
+    // The job currently being executed
+    void (*m_invoke)(void*, size_t) = nullptr;
+    void* m_context = nullptr;
+    size_t m_count = 0;
+    std::atomic<size_t> m_next = 0;
+};
@@ -0,0 +1,59 @@
+#include <algorithm>
+
+#include "TriangleArena.h"
+
+// Smallest number of triangles allocated at once, so the first frames don't grow one by one
+constexpr size_t MIN_ARENA_CAPACITY = 1024;
+
+void TriangleArena::reserve(size_t count)
+{
+    if (count <= m_capacity) {
+        return;
+    }
+
+    // Grow geometrically so a slowly growing frame doesn't reallocate every time
+    m_capacity = std::max({ count, m_capacity * 2, MIN_ARENA_CAPACITY });
+    for (int corner = 0; corner < 3; corner++) {
+        x[corner].resize(m_capacity);
+        y[corner].resize(m_capacity);
+        z[corner].resize(m_capacity);
+        w[corner].resize(m_capacity);
+        u[corner].resize(m_capacity);
+        v[corner].resize(m_capacity);
+    }
+    color.resize(m_capacity);
+}
+
+void TriangleArena::push(glm::vec4 a, glm::vec4 b, glm::vec4 c, glm::vec2 a_uv, glm::vec2 b_uv, glm::vec2 c_uv, uint32_t triangle_color)
+{
+    reserve(m_count + 1);
+
+    glm::vec4 points[3] = { a, b, c };
+    glm::vec2 uvs[3] = { a_uv, b_uv, c_uv };
+    for (int corner = 0; corner < 3; corner++) {
+        x[corner][m_count] = points[corner].x;
+        y[corner][m_count] = points[corner].y;
+        z[corner][m_count] = points[corner].z;
+        w[corner][m_count] = points[corner].w;
+        u[corner][m_count] = uvs[corner].x;
+        v[corner][m_count] = uvs[corner].y;
+    }
+    color[m_count] = triangle_color;
+    m_count++;
+}
+
+void TriangleArena::append(const TriangleArena& other)
+{
+    reserve(m_count + other.m_count);
+
+    for (int corner = 0; corner < 3; corner++) {
+        std::copy_n(other.x[corner].begin(), other.m_count, x[corner].begin() + m_count);
+        std::copy_n(other.y[corner].begin(), other.m_count, y[corner].begin() + m_count);
+        std::copy_n(other.z[corner].begin(), other.m_count, z[corner].begin() + m_count);
+        std::copy_n(other.w[corner].begin(), other.m_count, w[corner].begin() + m_count);
+        std::copy_n(other.u[corner].begin(), other.m_count, u[corner].begin() + m_count);
+        std::copy_n(other.v[corner].begin(), other.m_count, v[corner].begin() + m_count);
+    }
+    std::copy_n(other.color.begin(), other.m_count, color.begin() + m_count);
+    m_count += other.m_count;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+
+// Screen space triangles of one frame stored as a structure of arrays, x[1][i] is the x
+// coordinate of the second corner of triangle i. reset() only rewinds the count, so the
+// arrays grow to the largest frame seen and are reused without reallocating after that.
+class TriangleArena {
+public:
+    void reset() { m_count = 0; }
+    size_t size() const { return m_count; }
+    size_t capacity() const { return m_capacity; }
+
+    // Make room for at least count triangles in total, growing past the high-water mark
+    void reserve(size_t count);
+
+    void push(glm::vec4 a, glm::vec4 b, glm::vec4 c, glm::vec2 a_uv, glm::vec2 b_uv, glm::vec2 c_uv, uint32_t color);
+
+    // Copy all triangles of another arena onto the end of this one
+    void append(const TriangleArena& other);
+
+    glm::vec4 point(size_t index, int corner) const { return { x[corner][index], y[corner][index], z[corner][index], w[corner][index] }; }
+    glm::vec2 uv(size_t index, int corner) const { return { u[corner][index], v[corner][index] }; }
+
+    std::vector<float> x[3];
+    std::vector<float> y[3];
+    std::vector<float> z[3];
+    std::vector<float> w[3];
+    std::vector<float> u[3];
+    std::vector<float> v[3];
+    std::vector<uint32_t> color;
+
+private:
+    size_t m_count = 0;
+    size_t m_capacity = 0;
+};
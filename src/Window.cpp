@@ -3,9 +3,7 @@
 #include "Window.h"
 
 Window::Window(Framebuffer* fb, int width, int height)
-    : m_fb(fb)
-    , m_width(width)
-    , m_height(height)
+    : Display(fb, width, height)
 {
     if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
         fprintf(stderr, "Error initializing SDL.\n");
@@ -45,13 +43,29 @@ Window::~Window()
 void Window::render()
 {
     auto row_width = m_width * sizeof(uint32_t);
-    auto data = m_fb->get_color_buffer();
+    auto& data = m_fb->get_color_buffer();
 
-    SDL_UpdateTexture(m_texture, NULL, &data[0], row_width);
+    // Upload straight from the framebuffer, and only the part that changed since the last upload.
+    // The texture still holds the rest. When framebuffers take turns, the texture holds the other
+    // one's frame, which differs from this one only where either of them changed.
+    Rect changed = m_fb->get_changed_rect();
+    Rect upload = (m_uploaded_fb == m_fb) ? changed : union_rect(changed, m_uploaded_rect);
+    if (upload.x0 < upload.x1 && upload.y0 < upload.y1) {
+        SDL_Rect rect = { upload.x0, upload.y0, upload.x1 - upload.x0, upload.y1 - upload.y0 };
+        SDL_UpdateTexture(m_texture, &rect, &data[(m_width * upload.y0) + upload.x0], row_width);
+    }
+    m_fb->clear_changed_rect();
+    m_uploaded_fb = m_fb;
+    m_uploaded_rect = changed;
     SDL_RenderCopy(m_renderer, m_texture, NULL, NULL);
     SDL_RenderPresent(m_renderer);
 }
 
+bool Window::poll_event(SDL_Event* event)
+{
+    return SDL_PollEvent(event);
+}
+
 void Window::set_title(std::string title)
 {
     SDL_SetWindowTitle(m_window, title.c_str());
@@ -2,29 +2,25 @@
 #include <SDL2/SDL.h>
 #include <cstdint>
 
+#include "Display.h"
 #include "Framebuffer.h"
 
-constexpr int FPS = 30;
-constexpr int FRAME_TARGET_TIME = (1000 / FPS);
-
-class Window {
+class Window : public Display {
 public:
     Window(Framebuffer* fb, int width, int height);
     ~Window();
 
-    void render();
-
-    void set_title(std::string title);
+    void render() override;
+    bool poll_event(SDL_Event* event) override;
 
-    int get_width() { return m_width; }
-    int get_height() { return m_height; }
+    void set_title(std::string title) override;
 
 private:
-    Framebuffer* m_fb;
-    int m_width;
-    int m_height;
-
     SDL_Window* m_window = NULL;
     SDL_Renderer* m_renderer = NULL;
     SDL_Texture* m_texture = NULL;
+
+    // Framebuffer uploaded last and what changed in it, the texture holds that frame
+    Framebuffer* m_uploaded_fb = NULL;
+    Rect m_uploaded_rect = { 0, 0, 0, 0 };
 };
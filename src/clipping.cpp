@@ -1,5 +1,4 @@
 #include <math.h>
-#include <vector>
 
 #include <glm/glm.hpp> // vec3 normalize reflect dot pow
 
@@ -69,13 +68,27 @@ void init_frustum_planes(float fov_x, float fov_y, float znear, float zfar)
     frustum_planes[FAR_FRUSTUM_PLANE].normal.z = -1;
 }
 
-std::vector<Triangle> Polygon::clipped_triangles()
+/* Classify a point against all frustum planes at once. A triangle whose vertices share
+   an outside bit is entirely outside that plane, and one whose vertices all have a zero
+   outcode is entirely inside the frustum. The test matches the one used while clipping. */
+uint8_t frustum_outcode(glm::vec3 point)
+{
+    uint8_t outcode = 0;
+    for (int plane = 0; plane < NUM_PLANES; plane++) {
+        if (glm::dot(point - frustum_planes[plane].point, frustum_planes[plane].normal) <= 0) {
+            outcode |= (1 << plane);
+        }
+    }
+    return outcode;
+}
+
+int Polygon::clipped_triangles(Triangle triangles[MAX_NUM_POLY_TRIANGLES])
 {
     clip();
 
-    std::vector<Triangle> triangles;
+    int num_triangles = 0;
     for (int i = 0; i < num_vertices - 2; i++) {
-        Triangle triangle;
+        Triangle& triangle = triangles[num_triangles++];
         int index0 = 0;
         int index1 = i + 1;
         int index2 = i + 2;
@@ -87,9 +100,8 @@ std::vector<Triangle> Polygon::clipped_triangles()
         triangle.uvs[0] = texcoords[index0];
         triangle.uvs[1] = texcoords[index1];
         triangle.uvs[2] = texcoords[index2];
-        triangles.push_back(triangle);
     }
-    return triangles;
+    return num_triangles;
 }
 
 void Polygon::clip()
@@ -104,6 +116,11 @@ void Polygon::clip()
 
 void Polygon::clip_against_plane(int plane)
 {
+    // Nothing left to clip once an earlier plane removed the whole polygon
+    if (num_vertices == 0) {
+        return;
+    }
+
     glm::vec3 plane_point = frustum_planes[plane].point;
     glm::vec3 plane_normal = frustum_planes[plane].normal;
 
@@ -168,11 +185,121 @@ void Polygon::clip_against_plane(int plane)
     }
 
     // At the end, copy the list of inside vertices into the destination polygon (out parameter)
-    vertices.clear();
-    texcoords.clear();
     for (int i = 0; i < num_inside_vertices; i++) {
-        vertices.push_back(glm::vec3(inside_vertices[i]));
-        texcoords.push_back(glm::vec2(inside_texcoords[i]));
+        vertices[i] = inside_vertices[i];
+        texcoords[i] = inside_texcoords[i];
+    }
+    num_vertices = num_inside_vertices;
+}
+
+/* Signed distance of a clip space point to one of the frustum planes, positive inside.
+   After projection the frustum is the box -w <= x, y, z <= w, so every plane test is an
+   add or subtract against w instead of a dot product with a plane normal. The x and y
+   planes are scaled by the guard band, the rasterizer clips to the screen anything that
+   lands between the viewport and the guard band.
+
+        -w         w
+         |         |
+     ----+---------+----  y = w
+         | inside  |
+     ----+---------+----  y = -w
+         |         |
+*/
+static float clip_space_distance(glm::vec4 point, int plane, float guard_band)
+{
+    switch (plane) {
+    case LEFT_FRUSTUM_PLANE:
+        return guard_band * point.w + point.x;
+    case RIGHT_FRUSTUM_PLANE:
+        return guard_band * point.w - point.x;
+    case TOP_FRUSTUM_PLANE:
+        return guard_band * point.w - point.y;
+    case BOTTOM_FRUSTUM_PLANE:
+        return guard_band * point.w + point.y;
+    case NEAR_FRUSTUM_PLANE:
+        return point.w + point.z;
+    default:
+        return point.w - point.z;
+    }
+}
+
+uint8_t clip_space_outcode(glm::vec4 point, float guard_band)
+{
+    uint8_t outcode = 0;
+    for (int plane = 0; plane < NUM_PLANES; plane++) {
+        if (clip_space_distance(point, plane, guard_band) <= 0) {
+            outcode |= (1 << plane);
+        }
+    }
+    return outcode;
+}
+
+int ClipSpacePolygon::clipped_triangles(uint8_t planes, float guard_band, Triangle triangles[MAX_NUM_POLY_TRIANGLES])
+{
+    // Only clip against the planes at least one vertex is outside of
+    for (int plane = 0; plane < NUM_PLANES; plane++) {
+        if (planes & (1 << plane)) {
+            clip_against_plane(plane, guard_band);
+        }
+    }
+
+    int num_triangles = 0;
+    for (int i = 0; i < num_vertices - 2; i++) {
+        Triangle& triangle = triangles[num_triangles++];
+        triangle.points[0] = vertices[0];
+        triangle.points[1] = vertices[i + 1];
+        triangle.points[2] = vertices[i + 2];
+        triangle.uvs[0] = texcoords[0];
+        triangle.uvs[1] = texcoords[i + 1];
+        triangle.uvs[2] = texcoords[i + 2];
+    }
+    return num_triangles;
+}
+
+void ClipSpacePolygon::clip_against_plane(int plane, float guard_band)
+{
+    if (num_vertices == 0) {
+        return;
+    }
+
+    glm::vec4 inside_vertices[MAX_NUM_POLY_VERTICES];
+    glm::vec2 inside_texcoords[MAX_NUM_POLY_VERTICES];
+    int num_inside_vertices = 0;
+
+    // Walk the edges starting with the one from the last vertex to the first
+    int previous = num_vertices - 1;
+    float previous_distance = clip_space_distance(vertices[previous], plane, guard_band);
+
+    for (int current = 0; current < num_vertices; current++) {
+        float current_distance = clip_space_distance(vertices[current], plane, guard_band);
+
+        // The edge crosses the plane, interpolate every component including w
+        if (current_distance * previous_distance < 0) {
+            float t = previous_distance / (previous_distance - current_distance);
+            inside_vertices[num_inside_vertices] = glm::vec4(
+                float_lerp(vertices[previous].x, vertices[current].x, t),
+                float_lerp(vertices[previous].y, vertices[current].y, t),
+                float_lerp(vertices[previous].z, vertices[current].z, t),
+                float_lerp(vertices[previous].w, vertices[current].w, t));
+            inside_texcoords[num_inside_vertices] = glm::vec2(
+                float_lerp(texcoords[previous].x, texcoords[current].x, t),
+                float_lerp(texcoords[previous].y, texcoords[current].y, t));
+            num_inside_vertices++;
+        }
+
+        if (current_distance > 0) {
+            inside_vertices[num_inside_vertices] = vertices[current];
+            inside_texcoords[num_inside_vertices] = texcoords[current];
+            num_inside_vertices++;
+        }
+
+        previous = current;
+        previous_distance = current_distance;
+    }
+
+    for (int i = 0; i < num_inside_vertices; i++) {
+        vertices[i] = inside_vertices[i];
+        texcoords[i] = inside_texcoords[i];
     }
     num_vertices = num_inside_vertices;
 }
@@ -1,15 +1,20 @@
 #pragma once
 
-#include <vector>
+#include <stdint.h>
 
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
 
 #include "triangle.h"
 
 #define MAX_NUM_POLY_VERTICES 10
 #define MAX_NUM_POLY_TRIANGLES 10
 
+// Guard band extent in multiples of the viewport, kept small enough that the integer edge
+// functions of the rasterizer can't overflow on screen space coordinates inside it
+#define GUARD_BAND_SCALE 4.0f
+
 enum {
     LEFT_FRUSTUM_PLANE,
     RIGHT_FRUSTUM_PLANE,
@@ -32,16 +37,44 @@ public:
         , texcoords { t0, t1, t2 }
         , num_vertices(3) {};
 
-    std::vector<Triangle> clipped_triangles();
+    // Clip against the frustum and write the resulting fan into triangles, returns how many were written
+    int clipped_triangles(Triangle triangles[MAX_NUM_POLY_TRIANGLES]);
 
 private:
     void clip();
     void clip_against_plane(int plane);
 
-    std::vector<glm::vec3> vertices;
-    std::vector<glm::vec2> texcoords;
+    // Fixed capacity storage, a triangle clipped by all six planes never exceeds MAX_NUM_POLY_VERTICES
+    glm::vec3 vertices[MAX_NUM_POLY_VERTICES];
+    glm::vec2 texcoords[MAX_NUM_POLY_VERTICES];
+    int num_vertices;
+};
+
+// Polygon in homogeneous clip space, inside is -w <= x, y, z <= w
+class ClipSpacePolygon {
+public:
+    ClipSpacePolygon(glm::vec4 v0, glm::vec4 v1, glm::vec4 v2, glm::vec2 t0, glm::vec2 t1, glm::vec2 t2)
+        : vertices { v0, v1, v2 }
+        , texcoords { t0, t1, t2 }
+        , num_vertices(3) {};
+
+    // Clip against the planes set in the planes bit mask, with the x and y planes pushed out to
+    // guard_band * w, and write the resulting fan of clip space triangles into triangles
+    int clipped_triangles(uint8_t planes, float guard_band, Triangle triangles[MAX_NUM_POLY_TRIANGLES]);
+
+private:
+    void clip_against_plane(int plane, float guard_band);
+
+    glm::vec4 vertices[MAX_NUM_POLY_VERTICES];
+    glm::vec2 texcoords[MAX_NUM_POLY_VERTICES];
     int num_vertices;
 };
 
 void init_frustum_planes(float fov_x, float fov_y, float znear, float zfar);
+
+// Bit mask of the frustum planes a view space point is outside of, bit n is plane n
+uint8_t frustum_outcode(glm::vec3 point);
+
+// Same bit layout for a clip space point, with the x and y planes at guard_band * w
+uint8_t clip_space_outcode(glm::vec4 point, float guard_band);
 void clip_polygon(Polygon* polygon);
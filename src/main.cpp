@@ -1,6 +1,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <string>
 
 #include <SDL2/SDL.h>
@@ -10,20 +12,118 @@
 
 #include "Engine.h"
 #include "mesh.h"
+#include "span.h"
 #include "texture.h"
 #include "triangle.h"
 #include "upng.h"
 
-int main()
+static void usage(const char* program)
 {
-    Engine engine(1024, 768);
+    fprintf(stderr, "Usage: %s [--headless] [--frames N] [--dump DIR | --memory] [--isa scalar|sse4.1|avx2] [--latency 0|1|2]\n"
+                    "       [--pacing uncapped|fixed|timestep] [--fps N] [--wrap repeat|clamp] [--bench]\n", program);
+}
+
+int main(int argc, char* argv[])
+{
+    Backend backend = Backend::Window;
+    HeadlessOutput output = HeadlessOutput::None;
+    std::string dump_directory = ".";
+    int frames = 0;
+    int latency = -1;
+    PacingMode pacing = PacingMode::Fixed;
+    double rate = DEFAULT_FRAME_RATE;
+    bool bench = false;
+    TextureWrap wrap = TextureWrap::Repeat;
+
+    // Use the widest kernels the CPU supports, --isa may narrow them
+    select_span_kernels(SpanIsa::AVX2);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            backend = Backend::Headless;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            bench = true;
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            output = HeadlessOutput::Disk;
+            dump_directory = argv[++i];
+        } else if (strcmp(argv[i], "--memory") == 0) {
+            output = HeadlessOutput::Memory;
+        } else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+            latency = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--pacing") == 0 && i + 1 < argc) {
+            const char* mode = argv[++i];
+            if (strcmp(mode, "uncapped") == 0) {
+                pacing = PacingMode::Uncapped;
+            } else if (strcmp(mode, "timestep") == 0) {
+                pacing = PacingMode::FixedTimestep;
+            } else if (strcmp(mode, "fixed") == 0) {
+                pacing = PacingMode::Fixed;
+            } else {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--wrap") == 0 && i + 1 < argc) {
+            const char* mode = argv[++i];
+            if (strcmp(mode, "repeat") == 0) {
+                wrap = TextureWrap::Repeat;
+            } else if (strcmp(mode, "clamp") == 0) {
+                wrap = TextureWrap::Clamp;
+            } else {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            rate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--isa") == 0 && i + 1 < argc) {
+            const char* isa = argv[++i];
+            if (strcmp(isa, "scalar") == 0) {
+                select_span_kernels(SpanIsa::Scalar);
+            } else if (strcmp(isa, "sse4.1") == 0) {
+                select_span_kernels(SpanIsa::SSE41);
+            } else if (strcmp(isa, "avx2") == 0) {
+                select_span_kernels(SpanIsa::AVX2);
+            } else {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // The benchmark renders headless, with --frames as the frames of each run, and prints its report
+    if (bench) {
+        Engine engine(1024, 768, Backend::Headless);
+        engine.set_texture_wrap(wrap);
+        if (latency >= 0) {
+            engine.set_max_latency(latency);
+        }
+        engine.setup();
+        return engine.run_benchmark(frames > 0 ? frames : DEFAULT_BENCH_FRAMES) ? 0 : EXIT_FAILURE;
+    }
+
+    // Without a window nothing can close the loop, so never run headless forever
+    if (backend == Backend::Headless && frames <= 0) {
+        frames = 1;
+    }
+
+    Engine engine(1024, 768, backend);
+    engine.set_headless_output(output, dump_directory);
+    engine.set_frame_limit(frames);
+    engine.set_pacing(pacing, rate);
+    engine.set_texture_wrap(wrap);
+    if (latency >= 0) {
+        engine.set_max_latency(latency);
+    }
     engine.setup();
 
     while (engine.is_running()) {
         engine.process_input();
-        engine.update();
-        engine.render();
+        engine.run_frame();
     }
 
-    return 0;
+    return engine.has_failed() ? EXIT_FAILURE : 0;
 }
@@ -1,59 +1,453 @@
-#include <glm/vec2.hpp>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glm/vec2.hpp>
 
+#include "MappedFile.h"
 #include "mesh.h"
 
-void load_obj_file_data(mesh_t* mesh, std::string filename)
-{
-    FILE* file;
-    file = fopen(filename.c_str(), "r");
-    char line[1024];
+// Files at least this large are split into chunks that are parsed in parallel
+constexpr size_t PARALLEL_PARSE_BYTES = 1 << 20;
 
-    std::vector<glm::vec2> uvs;
+// Most polygons in the wild are triangles or quads, anything beyond this is truncated
+constexpr int MAX_FACE_CORNERS = 64;
+
+// Sentinel for "no index", used for faces without texture coordinates
+constexpr int NO_INDEX = -0x7FFFFFFF;
+
+/* Binary mesh cache layout, in native byte order:
+
+     MeshCacheHeader
+     glm::vec3 vertices[num_vertices]
+     glm::vec2 uvs[num_vertices]
+     Face faces[num_faces]
+
+   Every array starts on a 4 byte boundary, so a mapped cache can be used in place. */
+constexpr char MESH_CACHE_MAGIC[4] = { 'R', 'M', 'S', 'H' };
+constexpr uint32_t MESH_CACHE_VERSION = 1;
+
+struct MeshCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t source_size;     // size in bytes of the OBJ file the cache was built from
+    int64_t source_mtime;     // modification time of that OBJ file in nanoseconds
+    uint32_t num_vertices;
+    uint32_t num_faces;
+};
+
+static_assert(sizeof(MeshCacheHeader) == 32);
+static_assert(sizeof(glm::vec3) == 12 && sizeof(glm::vec2) == 8 && sizeof(Face) == 12);
+
+// One face corner as written in the file. Negative OBJ indices count back from the
+// vertices read so far, which a chunk can only resolve relative to its own start.
+struct ObjCorner {
+    int vertex;
+    int uv;
+    bool vertex_relative;
+    bool uv_relative;
+};
+
+// Everything parsed from one chunk of the file, triangulated corners come in threes
+struct ObjChunk {
     std::vector<glm::vec3> vertices;
+    std::vector<glm::vec2> uvs;
+    std::vector<ObjCorner> corners;
+};
+
+static const double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static const char* skip_spaces(const char* p, const char* end)
+{
+    while (p < end && is_space(*p)) {
+        p++;
+    }
+    return p;
+}
+
+static const char* skip_line(const char* p, const char* end)
+{
+    const char* newline = (const char*)memchr(p, '\n', end - p);
+    return newline ? newline + 1 : end;
+}
+
+// Parse a decimal float such as -1.25e-3 without going through the C locale
+static const char* parse_float(const char* p, const char* end, float* value)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += (mantissa != 0);
+        } else {
+            exponent++;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += (mantissa != 0);
+                exponent--;
+            }
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool negative_exponent = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative_exponent = (*p == '-');
+            p++;
+        }
+        int e = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            e = std::min(e * 10 + (*p - '0'), 9999);
+        }
+        exponent += negative_exponent ? -e : e;
+    }
+
+    double result = mantissa;
+    if (exponent < 0) {
+        result = (exponent >= -22) ? result / powers_of_ten[-exponent] : result * pow(10.0, exponent);
+    } else if (exponent > 0) {
+        result = (exponent <= 22) ? result * powers_of_ten[exponent] : result * pow(10.0, exponent);
+    }
+    *value = negative ? -result : result;
+    return p;
+}
+
+static const char* parse_int(const char* p, const char* end, int* value)
+{
+    bool negative = false;
+    if (p < end && *p == '-') {
+        negative = true;
+        p++;
+    }
+    int result = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        result = result * 10 + (*p - '0');
+    }
+    *value = negative ? -result : result;
+    return p;
+}
+
+// Turn a 1-based or negative OBJ index into a 0-based one, relative to the chunk for negative ones
+static void resolve_index(int index, int count_so_far, int* resolved, bool* relative)
+{
+    if (index > 0) {
+        *resolved = index - 1;
+        *relative = false;
+    } else if (index < 0) {
+        *resolved = count_so_far + index;
+        *relative = true;
+    } else {
+        *resolved = NO_INDEX;
+        *relative = false;
+    }
+}
+
+// Parse the "v", "vt" and "f" lines in [p, end), which must start at the beginning of a line
+static void parse_obj_chunk(const char* p, const char* end, ObjChunk* chunk)
+{
+    ObjCorner corners[MAX_FACE_CORNERS];
+
+    while (p < end) {
+        p = skip_spaces(p, end);
 
-    while (fgets(line, 1024, file)) {
         // Vertex information
-        if (strncmp(line, "v ", 2) == 0) {
+        if (end - p > 1 && p[0] == 'v' && is_space(p[1])) {
             glm::vec3 vertex;
-            sscanf(line, "v %f %f %f", &vertex.x, &vertex.y, &vertex.z);
-            vertices.push_back(vertex);
+            p = parse_float(skip_spaces(p + 2, end), end, &vertex.x);
+            p = parse_float(skip_spaces(p, end), end, &vertex.y);
+            p = parse_float(skip_spaces(p, end), end, &vertex.z);
+            chunk->vertices.push_back(vertex);
         }
         // Texture coordinate information
-        if (strncmp(line, "vt ", 3) == 0) {
+        else if (end - p > 2 && p[0] == 'v' && p[1] == 't' && is_space(p[2])) {
             glm::vec2 uv;
-            sscanf(line, "vt %f %f", &uv.x, &uv.y);
-            uvs.push_back(uv);
-        }
-        // Face information
-        if (strncmp(line, "f ", 2) == 0) {
-            int vertex_indices[3];
-            int texture_indices[3];
-            int normal_indices[3];
-            sscanf(
-                line, "f %d/%d/%d %d/%d/%d %d/%d/%d",
-                &vertex_indices[0], &texture_indices[0], &normal_indices[0],
-                &vertex_indices[1], &texture_indices[1], &normal_indices[1],
-                &vertex_indices[2], &texture_indices[2], &normal_indices[2]);
-
-            Face face = {
-                .a = {
-                    .point = vertices[vertex_indices[0] - 1],
-                    .uv = uvs[texture_indices[0] - 1],
-                },
-                .b = {
-                    .point = vertices[vertex_indices[1] - 1],
-                    .uv = uvs[texture_indices[1] - 1],
-                },
-                .c = {
-                    .point = vertices[vertex_indices[2] - 1],
-                    .uv = uvs[texture_indices[2] - 1],
-                },
-                .color = 0xFFFFFFFF
-            };
-            mesh->faces.push_back(face);
-        };
-    }
-    fclose(file);
+            p = parse_float(skip_spaces(p + 3, end), end, &uv.x);
+            p = parse_float(skip_spaces(p, end), end, &uv.y);
+            chunk->uvs.push_back(uv);
+        }
+        // Face information, any of "f v", "f v/t", "f v//n" and "f v/t/n" with three or more corners
+        else if (end - p > 1 && p[0] == 'f' && is_space(p[1])) {
+            int num_corners = 0;
+            p = skip_spaces(p + 2, end);
+            while (p < end && *p != '\n' && num_corners < MAX_FACE_CORNERS) {
+                int vertex = 0;
+                int uv = 0;
+                int normal = 0;
+                p = parse_int(p, end, &vertex);
+                if (p < end && *p == '/') {
+                    p++;
+                    if (p < end && *p != '/') {
+                        p = parse_int(p, end, &uv);
+                    }
+                    if (p < end && *p == '/') {
+                        p = parse_int(p + 1, end, &normal);
+                    }
+                }
+
+                ObjCorner& corner = corners[num_corners++];
+                resolve_index(vertex, chunk->vertices.size(), &corner.vertex, &corner.vertex_relative);
+                resolve_index(uv, chunk->uvs.size(), &corner.uv, &corner.uv_relative);
+
+                const char* next = skip_spaces(p, end);
+                if (next == p && next < end && *next != '\n') {
+                    // Not a separator, give up on the rest of the line
+                    break;
+                }
+                p = next;
+            }
+
+            // Triangulate polygons as a fan around the first corner
+            for (int i = 1; i + 1 < num_corners; i++) {
+                chunk->corners.push_back(corners[0]);
+                chunk->corners.push_back(corners[i]);
+                chunk->corners.push_back(corners[i + 1]);
+            }
+        }
+
+        p = skip_line(p, end);
+    }
+}
+
+// Split [begin, end) into about count pieces that each start at the beginning of a line
+static std::vector<const char*> split_lines(const char* begin, const char* end, size_t count)
+{
+    std::vector<const char*> bounds = { begin };
+    size_t step = (end - begin) / count;
+    for (size_t i = 1; i < count; i++) {
+        const char* split = std::max(bounds.back(), begin + i * step);
+        bounds.push_back(skip_line(split, end));
+    }
+    bounds.push_back(end);
+    return bounds;
+}
+
+/* Parse an OBJ file into indexed arrays.
+   Every distinct (position, texture coordinate) pair becomes one entry in the shared
+   vertex and uv arrays, and faces only store three indices into them. */
+static bool parse_obj_file(mesh_storage_t* mesh, std::string filename, ThreadPool* pool)
+{
+    MappedFile file(filename);
+    if (!file.is_open()) {
+        fprintf(stderr, "Error opening OBJ file %s.\n", filename.c_str());
+        return false;
+    }
+
+    const char* begin = file.data();
+    const char* end = begin + file.size();
+
+    size_t num_chunks = 1;
+    if (pool && file.size() >= PARALLEL_PARSE_BYTES) {
+        num_chunks = pool->size() * 4;
+    }
+    auto bounds = split_lines(begin, end, num_chunks);
+
+    std::vector<ObjChunk> chunks(num_chunks);
+    if (num_chunks > 1) {
+        pool->parallel_for(num_chunks, [&](size_t i) {
+            parse_obj_chunk(bounds[i], bounds[i + 1], &chunks[i]);
+        });
+    } else {
+        parse_obj_chunk(begin, end, &chunks[0]);
+    }
+
+    // Concatenate the positions and texture coordinates of all the chunks
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> texcoords;
+    size_t num_corners = 0;
+    for (auto& chunk : chunks) {
+        positions.insert(positions.end(), chunk.vertices.begin(), chunk.vertices.end());
+        texcoords.insert(texcoords.end(), chunk.uvs.begin(), chunk.uvs.end());
+        num_corners += chunk.corners.size();
+    }
+
+    mesh->faces.reserve(num_corners / 3);
+
+    // For every position, a linked list of the mesh vertices already created with it
+    constexpr uint32_t NONE = UINT32_MAX;
+    std::vector<uint32_t> first_vertex(positions.size(), NONE);
+    std::vector<uint32_t> next_vertex;
+    std::vector<int> vertex_uv;
+
+    int vertex_base = 0;
+    int uv_base = 0;
+    for (auto& chunk : chunks) {
+        for (size_t i = 0; i < chunk.corners.size(); i += 3) {
+            uint32_t indices[3];
+            for (int j = 0; j < 3; j++) {
+                const ObjCorner& corner = chunk.corners[i + j];
+                int position = corner.vertex + (corner.vertex_relative ? vertex_base : 0);
+                int uv = corner.uv;
+                if (uv != NO_INDEX) {
+                    uv += (corner.uv_relative ? uv_base : 0);
+                }
+
+                if (position < 0 || position >= (int)positions.size() || (uv != NO_INDEX && (uv < 0 || uv >= (int)texcoords.size()))) {
+                    fprintf(stderr, "Error in OBJ file %s: face index out of range.\n", filename.c_str());
+                    return false;
+                }
+
+                // Reuse the vertex if this position was already seen with the same texture coordinate
+                uint32_t vertex = first_vertex[position];
+                while (vertex != NONE && vertex_uv[vertex] != uv) {
+                    vertex = next_vertex[vertex];
+                }
+                if (vertex == NONE) {
+                    vertex = mesh->vertices.size();
+                    mesh->vertices.push_back(positions[position]);
+                    mesh->uvs.push_back(uv != NO_INDEX ? texcoords[uv] : glm::vec2(0, 0));
+                    vertex_uv.push_back(uv);
+                    next_vertex.push_back(first_vertex[position]);
+                    first_vertex[position] = vertex;
+                }
+                indices[j] = vertex;
+            }
+            mesh->faces.push_back({ indices[0], indices[1], indices[2] });
+        }
+        vertex_base += chunk.vertices.size();
+        uv_base += chunk.uvs.size();
+    }
+
+    return true;
+}
+
+// The cache lives next to the OBJ file, with the extension swapped for .mesh
+static std::string mesh_cache_filename(std::string filename)
+{
+    auto dot = filename.rfind('.');
+    auto slash = filename.rfind('/');
+    if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+        filename.resize(dot);
+    }
+    return filename + ".mesh";
+}
+
+// Map the cache and point the mesh at its arrays, if it was built from this exact OBJ file
+static bool load_mesh_cache(mesh_t* mesh, std::string cache_filename, const struct stat& source)
+{
+    auto file = std::make_unique<MappedFile>(cache_filename);
+    if (!file->is_open() || file->size() < sizeof(MeshCacheHeader)) {
+        return false;
+    }
+
+    const MeshCacheHeader* header = (const MeshCacheHeader*)file->data();
+    if (memcmp(header->magic, MESH_CACHE_MAGIC, 4) != 0 || header->version != MESH_CACHE_VERSION) {
+        return false;
+    }
+    if (header->source_size != (uint64_t)source.st_size || header->source_mtime != source.st_mtim.tv_sec * 1000000000LL + source.st_mtim.tv_nsec) {
+        return false;
+    }
+
+    size_t vertices_offset = sizeof(MeshCacheHeader);
+    size_t uvs_offset = vertices_offset + header->num_vertices * sizeof(glm::vec3);
+    size_t faces_offset = uvs_offset + header->num_vertices * sizeof(glm::vec2);
+    if (file->size() != faces_offset + header->num_faces * sizeof(Face)) {
+        return false;
+    }
+
+    // A damaged cache of the right size would otherwise send the geometry stage reading past the vertices
+    const char* data = file->data();
+    std::span<const Face> faces = { (const Face*)(data + faces_offset), header->num_faces };
+    for (const Face& face : faces) {
+        if (face.a >= header->num_vertices || face.b >= header->num_vertices || face.c >= header->num_vertices) {
+            return false;
+        }
+    }
+
+    mesh->vertices = { (const glm::vec3*)(data + vertices_offset), header->num_vertices };
+    mesh->uvs = { (const glm::vec2*)(data + uvs_offset), header->num_vertices };
+    mesh->faces = faces;
+
+    mesh->storage = std::make_shared<mesh_storage_t>();
+    mesh->storage->cache = std::move(file);
+    return true;
+}
+
+// Write the cache to a temporary file first so a concurrent reader never sees half of it. Every
+// writer gets a file of its own, processes building the same cache at once would interleave in one.
+static void write_mesh_cache(const mesh_storage_t& mesh, std::string cache_filename, const struct stat& source)
+{
+    MeshCacheHeader header;
+    memcpy(header.magic, MESH_CACHE_MAGIC, 4);
+    header.version = MESH_CACHE_VERSION;
+    header.source_size = source.st_size;
+    header.source_mtime = source.st_mtim.tv_sec * 1000000000LL + source.st_mtim.tv_nsec;
+    header.num_vertices = mesh.vertices.size();
+    header.num_faces = mesh.faces.size();
+
+    std::string temp_filename = cache_filename + ".XXXXXX";
+    int fd = mkstemp(temp_filename.data());
+    if (fd < 0) {
+        return;
+    }
+
+    // mkstemp creates the file readable by its owner only, the cache is as public as the OBJ file
+    fchmod(fd, 0644);
+    FILE* file = fdopen(fd, "wb");
+    if (!file) {
+        close(fd);
+        unlink(temp_filename.c_str());
+        return;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(mesh.vertices.data(), sizeof(glm::vec3), mesh.vertices.size(), file) == mesh.vertices.size();
+    ok = ok && fwrite(mesh.uvs.data(), sizeof(glm::vec2), mesh.uvs.size(), file) == mesh.uvs.size();
+    ok = ok && fwrite(mesh.faces.data(), sizeof(Face), mesh.faces.size(), file) == mesh.faces.size();
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(temp_filename.c_str(), cache_filename.c_str()) != 0) {
+        unlink(temp_filename.c_str());
+    }
+}
+
+// Load an OBJ file into an indexed mesh, going through the binary mesh cache when it is up to date
+bool load_obj_file_data(mesh_t* mesh, std::string filename, ThreadPool* pool)
+{
+    struct stat source;
+    if (stat(filename.c_str(), &source) != 0) {
+        fprintf(stderr, "Error opening OBJ file %s.\n", filename.c_str());
+        return false;
+    }
+
+    std::string cache_filename = mesh_cache_filename(filename);
+    if (load_mesh_cache(mesh, cache_filename, source)) {
+        return true;
+    }
+
+    auto storage = std::make_shared<mesh_storage_t>();
+    if (!parse_obj_file(storage.get(), filename, pool)) {
+        return false;
+    }
+    write_mesh_cache(*storage, cache_filename, source);
+
+    mesh->vertices = storage->vertices;
+    mesh->uvs = storage->uvs;
+    mesh->faces = storage->faces;
+    mesh->storage = storage;
+    return true;
 }
@@ -1,8 +1,14 @@
 #pragma once
 
+#include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
+#include <memory>
+#include <span>
+#include <string>
 #include <vector>
 
+#include "MappedFile.h"
+#include "ThreadPool.h"
 #include "triangle.h"
 
 #define MAX_TEX_TRIS 512
@@ -16,12 +22,28 @@
 #define MAX_TRIS TOTAL_TRIS + 2 * TOTAL_QUADS
 #define MAX_VERTS TOTAL_TRIS * 3 * 3
 
-// Define a struct for dynamic size meshes, with array of vertices and faces
+// Memory behind the mesh arrays, either parsed from an OBJ file or mapped from its mesh cache
 typedef struct {
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec2> uvs;
     std::vector<Face> faces;
-    glm::vec3 rotation;    // rotation with x, y, and z values
-    glm::vec3 scale;       // scale with x, y, and z values
-    glm::vec3 translation; // translation with x, y, and z values
+    std::unique_ptr<MappedFile> cache;
+} mesh_storage_t;
+
+// Define a struct for dynamic size meshes, with shared vertex arrays and faces indexing into them
+typedef struct {
+    std::span<const glm::vec3> vertices;     // position of every vertex
+    std::span<const glm::vec2> uvs;          // texture coordinate of every vertex
+    std::span<const Face> faces;             // three vertex indices per triangle
+    std::shared_ptr<mesh_storage_t> storage; // keeps the arrays above alive
+    uint32_t color;                          // color used to light untextured faces
+    glm::vec3 rotation;                      // rotation with x, y, and z values
+    glm::vec3 scale;                         // scale with x, y, and z values
+    glm::vec3 translation;                   // translation with x, y, and z values
 } mesh_t;
 
-void load_obj_file_data(mesh_t* mesh, std::string filename);
+// Returns false if the file can not be read or references missing vertices.
+// Large files are parsed in parallel chunks when a thread pool is given.
+// A binary mesh cache is written next to the OBJ file and used instead of parsing
+// for as long as the size and modification time of the OBJ file stay the same.
+bool load_obj_file_data(mesh_t* mesh, std::string filename, ThreadPool* pool = nullptr);
@@ -0,0 +1,439 @@
+#include <stdlib.h>
+
+#include "span.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#    define SPAN_X86 1
+#    include <immintrin.h>
+#endif
+
+static int filled_span_scalar(const Span& span, uint32_t color)
+{
+    int written = 0;
+    int w0 = span.w0;
+    int w1 = span.w1;
+    int w2 = span.w2;
+    float reciprocal_w = span.reciprocal_w;
+
+    for (int x = 0; x < span.count; x++) {
+        // The pixel is covered when no edge function is negative
+        if ((w0 | w1 | w2) >= 0) {
+            float depth = 1.0 - reciprocal_w;
+            if (depth < span.depth[x]) {
+                span.color[x] = color;
+                span.depth[x] = depth;
+                written++;
+            }
+        }
+        w0 += span.w0_dx;
+        w1 += span.w1_dx;
+        w2 += span.w2_dx;
+        reciprocal_w += span.reciprocal_w_dx;
+    }
+    return written;
+}
+
+// Every textured kernel is instantiated per wrap mode and texture size class, see Texture::wrap
+template<TextureWrap Wrap, bool PowerOfTwo>
+static int textured_span_scalar(const Span& span, const TextureLevel& texture)
+{
+    int written = 0;
+    int w0 = span.w0;
+    int w1 = span.w1;
+    int w2 = span.w2;
+    float reciprocal_w = span.reciprocal_w;
+    float u = span.u;
+    float v = span.v;
+
+    for (int x = 0; x < span.count; x++) {
+        if ((w0 | w1 | w2) >= 0) {
+            float depth = 1.0 - reciprocal_w;
+            if (depth < span.depth[x]) {
+                // Divide back by 1/w to get the perspective correct texture coordinate
+                span.color[x] = Texture::sample<Wrap, PowerOfTwo>(texture, u / reciprocal_w, v / reciprocal_w);
+                span.depth[x] = depth;
+                written++;
+            }
+        }
+        w0 += span.w0_dx;
+        w1 += span.w1_dx;
+        w2 += span.w2_dx;
+        reciprocal_w += span.reciprocal_w_dx;
+        u += span.u_dx;
+        v += span.v_dx;
+    }
+    return written;
+}
+
+#ifdef SPAN_X86
+
+/* SSE4.1 kernels, four pixels per iteration.
+   There is no masked store or gather, so the depth and color are blended and written
+   back whole, and only full groups of four are done here. The tail goes to the scalar
+   kernel so nothing past the end of the span is ever touched. */
+
+// Texture::wrap for four lanes. Without a power of two size abs(i) % size is done with a float
+// reciprocal, fixing up the off by one cases.
+template<TextureWrap Wrap, bool PowerOfTwo>
+__attribute__((target("sse4.1"))) static inline __m128i wrap_texel_sse(__m128 coordinate, __m128 size_f, __m128 inv_size, __m128i size)
+{
+    __m128i i = _mm_cvttps_epi32(_mm_mul_ps(coordinate, size_f));
+    if constexpr (Wrap == TextureWrap::Clamp) {
+        return _mm_min_epi32(_mm_max_epi32(i, _mm_setzero_si128()), _mm_sub_epi32(size, _mm_set1_epi32(1)));
+    }
+    i = _mm_abs_epi32(i);
+    if constexpr (PowerOfTwo) {
+        // abs(INT_MIN) stays negative, but masking still lands it inside the texture
+        return _mm_and_si128(i, _mm_sub_epi32(size, _mm_set1_epi32(1)));
+    }
+    __m128i q = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(i), inv_size));
+    __m128i r = _mm_sub_epi32(i, _mm_mullo_epi32(q, size));
+    r = _mm_add_epi32(r, _mm_and_si128(_mm_cmplt_epi32(r, _mm_setzero_si128()), size));
+    r = _mm_sub_epi32(r, _mm_andnot_si128(_mm_cmplt_epi32(r, size), size));
+    // Keep garbage from degenerate lanes inside the texture
+    return _mm_min_epi32(_mm_max_epi32(r, _mm_setzero_si128()), _mm_sub_epi32(size, _mm_set1_epi32(1)));
+}
+
+// Texture::tiled_index for four lanes, or the row major index for other sizes
+template<bool PowerOfTwo>
+__attribute__((target("sse4.1"))) static inline __m128i texel_index_sse(__m128i tex_x, __m128i tex_y, __m128i width, __m128i width_shift)
+{
+    if constexpr (PowerOfTwo) {
+        const __m128i low = _mm_set1_epi32(3);
+        __m128i row = _mm_add_epi32(_mm_sll_epi32(_mm_andnot_si128(low, tex_y), width_shift), _mm_slli_epi32(_mm_and_si128(tex_y, low), 2));
+        __m128i column = _mm_add_epi32(_mm_slli_epi32(_mm_andnot_si128(low, tex_x), 2), _mm_and_si128(tex_x, low));
+        return _mm_add_epi32(row, column);
+    }
+    return _mm_add_epi32(_mm_mullo_epi32(tex_y, width), tex_x);
+}
+
+__attribute__((target("sse4.1"))) static int filled_span_sse41(const Span& span, uint32_t color)
+{
+    int written = 0;
+    const __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128 lane_f = _mm_setr_ps(0, 1, 2, 3);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128i minus_one = _mm_set1_epi32(-1);
+    const __m128i color_v = _mm_set1_epi32(color);
+
+    __m128i w0 = _mm_add_epi32(_mm_set1_epi32(span.w0), _mm_mullo_epi32(lane, _mm_set1_epi32(span.w0_dx)));
+    __m128i w1 = _mm_add_epi32(_mm_set1_epi32(span.w1), _mm_mullo_epi32(lane, _mm_set1_epi32(span.w1_dx)));
+    __m128i w2 = _mm_add_epi32(_mm_set1_epi32(span.w2), _mm_mullo_epi32(lane, _mm_set1_epi32(span.w2_dx)));
+    __m128 reciprocal_w = _mm_add_ps(_mm_set1_ps(span.reciprocal_w), _mm_mul_ps(lane_f, _mm_set1_ps(span.reciprocal_w_dx)));
+
+    const __m128i w0_step = _mm_set1_epi32(span.w0_dx * 4);
+    const __m128i w1_step = _mm_set1_epi32(span.w1_dx * 4);
+    const __m128i w2_step = _mm_set1_epi32(span.w2_dx * 4);
+    const __m128 reciprocal_w_step = _mm_set1_ps(span.reciprocal_w_dx * 4);
+
+    int full = span.count & ~3;
+    for (int x = 0; x < full; x += 4) {
+        __m128i covered = _mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(w0, w1), w2), minus_one);
+        if (_mm_movemask_epi8(covered)) {
+            __m128 depth = _mm_sub_ps(one, reciprocal_w);
+            __m128 stored_depth = _mm_loadu_ps(span.depth + x);
+            __m128 pass = _mm_and_ps(_mm_castsi128_ps(covered), _mm_cmplt_ps(depth, stored_depth));
+            int pass_bits = _mm_movemask_ps(pass);
+            if (pass_bits) {
+                __m128i* color_ptr = (__m128i*)(span.color + x);
+                __m128i stored_color = _mm_loadu_si128(color_ptr);
+                _mm_storeu_si128(color_ptr, _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(stored_color), _mm_castsi128_ps(color_v), pass)));
+                _mm_storeu_ps(span.depth + x, _mm_blendv_ps(stored_depth, depth, pass));
+                written += __builtin_popcount(pass_bits);
+            }
+        }
+        w0 = _mm_add_epi32(w0, w0_step);
+        w1 = _mm_add_epi32(w1, w1_step);
+        w2 = _mm_add_epi32(w2, w2_step);
+        reciprocal_w = _mm_add_ps(reciprocal_w, reciprocal_w_step);
+    }
+
+    if (full < span.count) {
+        written += filled_span_scalar(advance_span(span, full), color);
+    }
+    return written;
+}
+
+template<TextureWrap Wrap, bool PowerOfTwo>
+__attribute__((target("sse4.1"))) static int textured_span_sse41(const Span& span, const TextureLevel& texture)
+{
+    int written = 0;
+    const uint32_t* texels = texture.texels;
+    int texture_width = texture.width;
+    int texture_height = texture.height;
+    const __m128i width_shift = _mm_cvtsi32_si128(texture.width_shift);
+
+    const __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128 lane_f = _mm_setr_ps(0, 1, 2, 3);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128i minus_one = _mm_set1_epi32(-1);
+
+    const __m128i width = _mm_set1_epi32(texture_width);
+    const __m128i height = _mm_set1_epi32(texture_height);
+    const __m128 width_f = _mm_set1_ps(texture_width);
+    const __m128 height_f = _mm_set1_ps(texture_height);
+    const __m128 inv_width = _mm_set1_ps(1.0f / texture_width);
+    const __m128 inv_height = _mm_set1_ps(1.0f / texture_height);
+
+    __m128i w0 = _mm_add_epi32(_mm_set1_epi32(span.w0), _mm_mullo_epi32(lane, _mm_set1_epi32(span.w0_dx)));
+    __m128i w1 = _mm_add_epi32(_mm_set1_epi32(span.w1), _mm_mullo_epi32(lane, _mm_set1_epi32(span.w1_dx)));
+    __m128i w2 = _mm_add_epi32(_mm_set1_epi32(span.w2), _mm_mullo_epi32(lane, _mm_set1_epi32(span.w2_dx)));
+    __m128 reciprocal_w = _mm_add_ps(_mm_set1_ps(span.reciprocal_w), _mm_mul_ps(lane_f, _mm_set1_ps(span.reciprocal_w_dx)));
+    __m128 u = _mm_add_ps(_mm_set1_ps(span.u), _mm_mul_ps(lane_f, _mm_set1_ps(span.u_dx)));
+    __m128 v = _mm_add_ps(_mm_set1_ps(span.v), _mm_mul_ps(lane_f, _mm_set1_ps(span.v_dx)));
+
+    const __m128i w0_step = _mm_set1_epi32(span.w0_dx * 4);
+    const __m128i w1_step = _mm_set1_epi32(span.w1_dx * 4);
+    const __m128i w2_step = _mm_set1_epi32(span.w2_dx * 4);
+    const __m128 reciprocal_w_step = _mm_set1_ps(span.reciprocal_w_dx * 4);
+    const __m128 u_step = _mm_set1_ps(span.u_dx * 4);
+    const __m128 v_step = _mm_set1_ps(span.v_dx * 4);
+
+    int full = span.count & ~3;
+    for (int x = 0; x < full; x += 4) {
+        __m128i covered = _mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(w0, w1), w2), minus_one);
+        if (_mm_movemask_epi8(covered)) {
+            __m128 depth = _mm_sub_ps(one, reciprocal_w);
+            __m128 stored_depth = _mm_loadu_ps(span.depth + x);
+            __m128 pass = _mm_and_ps(_mm_castsi128_ps(covered), _mm_cmplt_ps(depth, stored_depth));
+            int pass_bits = _mm_movemask_ps(pass);
+            if (pass_bits) {
+                __m128i tex_x = wrap_texel_sse<Wrap, PowerOfTwo>(_mm_div_ps(u, reciprocal_w), width_f, inv_width, width);
+                __m128i tex_y = wrap_texel_sse<Wrap, PowerOfTwo>(_mm_div_ps(v, reciprocal_w), height_f, inv_height, height);
+                alignas(16) int index[4];
+                _mm_store_si128((__m128i*)index, texel_index_sse<PowerOfTwo>(tex_x, tex_y, width, width_shift));
+
+                // No gather before AVX2, fetch the texels of the passing lanes one by one
+                __m128i* color_ptr = (__m128i*)(span.color + x);
+                alignas(16) uint32_t texel[4];
+                _mm_store_si128((__m128i*)texel, _mm_loadu_si128(color_ptr));
+                for (int i = 0; i < 4; i++) {
+                    if (pass_bits & (1 << i)) {
+                        texel[i] = texels[index[i]];
+                    }
+                }
+                _mm_storeu_si128(color_ptr, _mm_load_si128((__m128i*)texel));
+                _mm_storeu_ps(span.depth + x, _mm_blendv_ps(stored_depth, depth, pass));
+                written += __builtin_popcount(pass_bits);
+            }
+        }
+        w0 = _mm_add_epi32(w0, w0_step);
+        w1 = _mm_add_epi32(w1, w1_step);
+        w2 = _mm_add_epi32(w2, w2_step);
+        reciprocal_w = _mm_add_ps(reciprocal_w, reciprocal_w_step);
+        u = _mm_add_ps(u, u_step);
+        v = _mm_add_ps(v, v_step);
+    }
+
+    if (full < span.count) {
+        written += textured_span_scalar<Wrap, PowerOfTwo>(advance_span(span, full), texture);
+    }
+    return written;
+}
+
+/* AVX2 kernels, eight pixels per iteration.
+   Masked loads and stores handle the ragged end of the span, and the texels of all
+   passing lanes are fetched with a single masked gather. */
+
+template<TextureWrap Wrap, bool PowerOfTwo>
+__attribute__((target("avx2"))) static inline __m256i wrap_texel_avx2(__m256 coordinate, __m256 size_f, __m256 inv_size, __m256i size)
+{
+    __m256i i = _mm256_cvttps_epi32(_mm256_mul_ps(coordinate, size_f));
+    if constexpr (Wrap == TextureWrap::Clamp) {
+        return _mm256_min_epi32(_mm256_max_epi32(i, _mm256_setzero_si256()), _mm256_sub_epi32(size, _mm256_set1_epi32(1)));
+    }
+    i = _mm256_abs_epi32(i);
+    if constexpr (PowerOfTwo) {
+        return _mm256_and_si256(i, _mm256_sub_epi32(size, _mm256_set1_epi32(1)));
+    }
+    __m256i q = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(i), inv_size));
+    __m256i r = _mm256_sub_epi32(i, _mm256_mullo_epi32(q, size));
+    r = _mm256_add_epi32(r, _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), r), size));
+    r = _mm256_sub_epi32(r, _mm256_andnot_si256(_mm256_cmpgt_epi32(size, r), size));
+    return _mm256_min_epi32(_mm256_max_epi32(r, _mm256_setzero_si256()), _mm256_sub_epi32(size, _mm256_set1_epi32(1)));
+}
+
+template<bool PowerOfTwo>
+__attribute__((target("avx2"))) static inline __m256i texel_index_avx2(__m256i tex_x, __m256i tex_y, __m256i width, __m128i width_shift)
+{
+    if constexpr (PowerOfTwo) {
+        const __m256i low = _mm256_set1_epi32(3);
+        __m256i row = _mm256_add_epi32(_mm256_sll_epi32(_mm256_andnot_si256(low, tex_y), width_shift), _mm256_slli_epi32(_mm256_and_si256(tex_y, low), 2));
+        __m256i column = _mm256_add_epi32(_mm256_slli_epi32(_mm256_andnot_si256(low, tex_x), 2), _mm256_and_si256(tex_x, low));
+        return _mm256_add_epi32(row, column);
+    }
+    return _mm256_add_epi32(_mm256_mullo_epi32(tex_y, width), tex_x);
+}
+
+// Lanes of the group starting at pixel x that are still inside the span
+__attribute__((target("avx2"))) static inline __m256i span_lanes_avx2(int remaining)
+{
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32(remaining), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+__attribute__((target("avx2"))) static int filled_span_avx2(const Span& span, uint32_t color)
+{
+    int written = 0;
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 lane_f = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256i minus_one = _mm256_set1_epi32(-1);
+    const __m256i color_v = _mm256_set1_epi32(color);
+
+    __m256i w0 = _mm256_add_epi32(_mm256_set1_epi32(span.w0), _mm256_mullo_epi32(lane, _mm256_set1_epi32(span.w0_dx)));
+    __m256i w1 = _mm256_add_epi32(_mm256_set1_epi32(span.w1), _mm256_mullo_epi32(lane, _mm256_set1_epi32(span.w1_dx)));
+    __m256i w2 = _mm256_add_epi32(_mm256_set1_epi32(span.w2), _mm256_mullo_epi32(lane, _mm256_set1_epi32(span.w2_dx)));
+    __m256 reciprocal_w = _mm256_add_ps(_mm256_set1_ps(span.reciprocal_w), _mm256_mul_ps(lane_f, _mm256_set1_ps(span.reciprocal_w_dx)));
+
+    const __m256i w0_step = _mm256_set1_epi32(span.w0_dx * 8);
+    const __m256i w1_step = _mm256_set1_epi32(span.w1_dx * 8);
+    const __m256i w2_step = _mm256_set1_epi32(span.w2_dx * 8);
+    const __m256 reciprocal_w_step = _mm256_set1_ps(span.reciprocal_w_dx * 8);
+
+    for (int x = 0; x < span.count; x += 8) {
+        __m256i covered = _mm256_cmpgt_epi32(_mm256_or_si256(_mm256_or_si256(w0, w1), w2), minus_one);
+        __m256i mask = _mm256_and_si256(covered, span_lanes_avx2(span.count - x));
+        if (!_mm256_testz_si256(mask, mask)) {
+            __m256 depth = _mm256_sub_ps(one, reciprocal_w);
+            __m256 stored_depth = _mm256_maskload_ps(span.depth + x, mask);
+            __m256i pass = _mm256_and_si256(mask, _mm256_castps_si256(_mm256_cmp_ps(depth, stored_depth, _CMP_LT_OQ)));
+            _mm256_maskstore_epi32((int*)(span.color + x), pass, color_v);
+            _mm256_maskstore_ps(span.depth + x, pass, depth);
+            written += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(pass)));
+        }
+        w0 = _mm256_add_epi32(w0, w0_step);
+        w1 = _mm256_add_epi32(w1, w1_step);
+        w2 = _mm256_add_epi32(w2, w2_step);
+        reciprocal_w = _mm256_add_ps(reciprocal_w, reciprocal_w_step);
+    }
+    return written;
+}
+
+template<TextureWrap Wrap, bool PowerOfTwo>
+__attribute__((target("avx2"))) static int textured_span_avx2(const Span& span, const TextureLevel& texture)
+{
+    int written = 0;
+    const uint32_t* texels = texture.texels;
+    int texture_width = texture.width;
+    int texture_height = texture.height;
+    const __m128i width_shift = _mm_cvtsi32_si128(texture.width_shift);
+
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 lane_f = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256i minus_one = _mm256_set1_epi32(-1);
+
+    const __m256i width = _mm256_set1_epi32(texture_width);
+    const __m256i height = _mm256_set1_epi32(texture_height);
+    const __m256 width_f = _mm256_set1_ps(texture_width);
+    const __m256 height_f = _mm256_set1_ps(texture_height);
+    const __m256 inv_width = _mm256_set1_ps(1.0f / texture_width);
+    const __m256 inv_height = _mm256_set1_ps(1.0f / texture_height);
+
+    __m256i w0 = _mm256_add_epi32(_mm256_set1_epi32(span.w0), _mm256_mullo_epi32(lane, _mm256_set1_epi32(span.w0_dx)));
+    __m256i w1 = _mm256_add_epi32(_mm256_set1_epi32(span.w1), _mm256_mullo_epi32(lane, _mm256_set1_epi32(span.w1_dx)));
+    __m256i w2 = _mm256_add_epi32(_mm256_set1_epi32(span.w2), _mm256_mullo_epi32(lane, _mm256_set1_epi32(span.w2_dx)));
+    __m256 reciprocal_w = _mm256_add_ps(_mm256_set1_ps(span.reciprocal_w), _mm256_mul_ps(lane_f, _mm256_set1_ps(span.reciprocal_w_dx)));
+    __m256 u = _mm256_add_ps(_mm256_set1_ps(span.u), _mm256_mul_ps(lane_f, _mm256_set1_ps(span.u_dx)));
+    __m256 v = _mm256_add_ps(_mm256_set1_ps(span.v), _mm256_mul_ps(lane_f, _mm256_set1_ps(span.v_dx)));
+
+    const __m256i w0_step = _mm256_set1_epi32(span.w0_dx * 8);
+    const __m256i w1_step = _mm256_set1_epi32(span.w1_dx * 8);
+    const __m256i w2_step = _mm256_set1_epi32(span.w2_dx * 8);
+    const __m256 reciprocal_w_step = _mm256_set1_ps(span.reciprocal_w_dx * 8);
+    const __m256 u_step = _mm256_set1_ps(span.u_dx * 8);
+    const __m256 v_step = _mm256_set1_ps(span.v_dx * 8);
+
+    for (int x = 0; x < span.count; x += 8) {
+        __m256i covered = _mm256_cmpgt_epi32(_mm256_or_si256(_mm256_or_si256(w0, w1), w2), minus_one);
+        __m256i mask = _mm256_and_si256(covered, span_lanes_avx2(span.count - x));
+        if (!_mm256_testz_si256(mask, mask)) {
+            __m256 depth = _mm256_sub_ps(one, reciprocal_w);
+            __m256 stored_depth = _mm256_maskload_ps(span.depth + x, mask);
+            __m256i pass = _mm256_and_si256(mask, _mm256_castps_si256(_mm256_cmp_ps(depth, stored_depth, _CMP_LT_OQ)));
+            if (!_mm256_testz_si256(pass, pass)) {
+                __m256i tex_x = wrap_texel_avx2<Wrap, PowerOfTwo>(_mm256_div_ps(u, reciprocal_w), width_f, inv_width, width);
+                __m256i tex_y = wrap_texel_avx2<Wrap, PowerOfTwo>(_mm256_div_ps(v, reciprocal_w), height_f, inv_height, height);
+                __m256i index = texel_index_avx2<PowerOfTwo>(tex_x, tex_y, width, width_shift);
+                __m256i texel = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*)texels, index, pass, 4);
+                _mm256_maskstore_epi32((int*)(span.color + x), pass, texel);
+                _mm256_maskstore_ps(span.depth + x, pass, depth);
+                written += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(pass)));
+            }
+        }
+        w0 = _mm256_add_epi32(w0, w0_step);
+        w1 = _mm256_add_epi32(w1, w1_step);
+        w2 = _mm256_add_epi32(w2, w2_step);
+        reciprocal_w = _mm256_add_ps(reciprocal_w, reciprocal_w_step);
+        u = _mm256_add_ps(u, u_step);
+        v = _mm256_add_ps(v, v_step);
+    }
+    return written;
+}
+
+#endif
+
+static SpanIsa span_isa = SpanIsa::Scalar;
+
+typedef int (*TexturedSpanKernel)(const Span& span, const TextureLevel& texture);
+
+// The instantiations of one textured kernel, indexed by [wrap mode][power of two]
+#define TEXTURED_SPAN_KERNELS(kernel)                                                    \
+    {                                                                                    \
+        { kernel<TextureWrap::Repeat, false>, kernel<TextureWrap::Repeat, true> },        \
+        { kernel<TextureWrap::Clamp, false>, kernel<TextureWrap::Clamp, true> },          \
+    }
+
+static const TexturedSpanKernel textured_span_scalar_kernels[2][2] = TEXTURED_SPAN_KERNELS(textured_span_scalar);
+#ifdef SPAN_X86
+static const TexturedSpanKernel textured_span_sse41_kernels[2][2] = TEXTURED_SPAN_KERNELS(textured_span_sse41);
+static const TexturedSpanKernel textured_span_avx2_kernels[2][2] = TEXTURED_SPAN_KERNELS(textured_span_avx2);
+#endif
+
+int (*draw_filled_span)(const Span& span, uint32_t color) = filled_span_scalar;
+static const TexturedSpanKernel (*textured_span_kernels)[2] = textured_span_scalar_kernels;
+
+int draw_textured_span(const Span& span, const Texture& texture, int level)
+{
+    return textured_span_kernels[(int)texture.get_wrap()][texture.is_power_of_two()](span, texture.get_level(level));
+}
+
+SpanIsa select_span_kernels(SpanIsa requested)
+{
+    span_isa = SpanIsa::Scalar;
+    draw_filled_span = filled_span_scalar;
+    textured_span_kernels = textured_span_scalar_kernels;
+
+#ifdef SPAN_X86
+    __builtin_cpu_init();
+    if (requested == SpanIsa::AVX2 && __builtin_cpu_supports("avx2")) {
+        span_isa = SpanIsa::AVX2;
+        draw_filled_span = filled_span_avx2;
+        textured_span_kernels = textured_span_avx2_kernels;
+    } else if (requested != SpanIsa::Scalar && __builtin_cpu_supports("sse4.1")) {
+        span_isa = SpanIsa::SSE41;
+        draw_filled_span = filled_span_sse41;
+        textured_span_kernels = textured_span_sse41_kernels;
+    }
+#endif
+
+    return span_isa;
+}
+
+SpanIsa get_span_isa()
+{
+    return span_isa;
+}
+
+const char* span_isa_name(SpanIsa isa)
+{
+    switch (isa) {
+    case SpanIsa::AVX2:
+        return "avx2";
+    case SpanIsa::SSE41:
+        return "sse4.1";
+    case SpanIsa::Scalar:
+        break;
+    }
+    return "scalar";
+}
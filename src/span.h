@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+
+#include "texture.h"
+
+// One row of a triangle's bounding box, with everything stepped across it by the edge rasterizer
+struct Span {
+    uint32_t* color; // color buffer at the first pixel of the span
+    float* depth;    // depth buffer at the first pixel of the span
+    int count;       // number of pixels in the span
+
+    // Biased edge function values at the first pixel and their step per pixel
+    int w0, w1, w2;
+    int w0_dx, w1_dx, w2_dx;
+
+    // Interpolated 1/w, u/w and v/w at the first pixel and their step per pixel
+    float reciprocal_w, reciprocal_w_dx;
+    float u, u_dx;
+    float v, v_dx;
+};
+
+// The rest of a span after skipping a number of pixels
+inline Span advance_span(const Span& span, int pixels)
+{
+    Span rest = span;
+    rest.color += pixels;
+    rest.depth += pixels;
+    rest.count -= pixels;
+    rest.w0 += span.w0_dx * pixels;
+    rest.w1 += span.w1_dx * pixels;
+    rest.w2 += span.w2_dx * pixels;
+    rest.reciprocal_w += span.reciprocal_w_dx * pixels;
+    rest.u += span.u_dx * pixels;
+    rest.v += span.v_dx * pixels;
+    return rest;
+}
+
+// Instruction sets the span kernels are available for
+enum class SpanIsa {
+    Scalar,
+    SSE41,
+    AVX2
+};
+
+// The kernels in use, the scalar ones until select_span_kernels picks others.
+// Both return the number of pixels that passed the depth test and were written.
+extern int (*draw_filled_span)(const Span& span, uint32_t color);
+int draw_textured_span(const Span& span, const Texture& texture, int level);
+
+// Switch to the kernels for the requested ISA, falling back to narrower ones when the CPU lacks it.
+// Returns the ISA actually selected.
+SpanIsa select_span_kernels(SpanIsa requested);
+SpanIsa get_span_isa(void);
+const char* span_isa_name(SpanIsa isa);
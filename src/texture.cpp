@@ -1,26 +1,147 @@
 #include "texture.h"
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <algorithm>
 #include "upng.h"
 
-int texture_width = 64;
-int texture_height = 64;
+static bool is_power_of_two(int size)
+{
+    return size > 0 && (size & (size - 1)) == 0;
+}
 
-uint32_t* load_png_texture_data(std::string filename)
+static int log2_int(int size)
 {
-    upng_t* png_texture = upng_new_from_file(filename.c_str());
-    uint32_t* mesh_texture = NULL;
-
-    if (png_texture != NULL) {
-        upng_decode(png_texture);
-        if (upng_get_error(png_texture) == UPNG_EOK) {
-            mesh_texture = (uint32_t*)upng_get_buffer(png_texture);
-            texture_width = upng_get_width(png_texture);
-            texture_height = upng_get_height(png_texture);
+    int shift = 0;
+    while ((1 << shift) < size) {
+        shift++;
+    }
+    return shift;
+}
+
+// Average four texels, channel by channel with rounding
+static uint32_t average(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+    uint32_t texel = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        uint32_t sum = ((a >> shift) & 0xFF) + ((b >> shift) & 0xFF) + ((c >> shift) & 0xFF) + ((d >> shift) & 0xFF);
+        texel |= ((sum + 2) / 4) << shift;
+    }
+    return texel;
+}
+
+Texture::Texture(int width, int height, TextureWrap wrap)
+    : m_width(width)
+    , m_height(height)
+    , m_power_of_two(::is_power_of_two(width) && ::is_power_of_two(height) && width >= TEXTURE_TILE_SIZE && height >= TEXTURE_TILE_SIZE)
+    , m_wrap(wrap)
+{
+    if (!m_power_of_two) {
+        m_texels.resize(width * height);
+        m_levels.push_back({ m_texels.data(), width, height, 0 });
+        return;
+    }
+
+    // The whole chain down to a single tile is a third larger than the base level at most
+    size_t total = 0;
+    for (int w = width, h = height; w >= TEXTURE_TILE_SIZE && h >= TEXTURE_TILE_SIZE; w /= 2, h /= 2) {
+        total += w * h;
+    }
+    m_texels.resize(total);
+
+    size_t offset = 0;
+    for (int w = width, h = height; w >= TEXTURE_TILE_SIZE && h >= TEXTURE_TILE_SIZE; w /= 2, h /= 2) {
+        m_levels.push_back({ &m_texels[offset], w, h, log2_int(w) });
+        offset += w * h;
+    }
+}
+
+void Texture::set_row(int y, const uint32_t* texels)
+{
+    uint32_t* base = level_texels(0);
+    if (!m_power_of_two) {
+        std::copy(texels, texels + m_width, base + (y * m_width));
+        return;
+    }
+
+    // The row crosses every tile of its tile row, four consecutive texels in each
+    uint32_t* row = base + tiled_index(0, y, m_levels[0].width_shift);
+    for (int x = 0; x < m_width; x += TEXTURE_TILE_SIZE) {
+        std::copy(texels + x, texels + x + TEXTURE_TILE_SIZE, row + (x * TEXTURE_TILE_SIZE));
+    }
+}
+
+void Texture::build_mip_chain()
+{
+    // Average every 2x2 block of texels into one, reading and writing tiled levels directly
+    for (int level = 1; level < get_level_count(); level++) {
+        const TextureLevel& source = m_levels[level - 1];
+        const TextureLevel& target = m_levels[level];
+        const uint32_t* in = source.texels;
+        uint32_t* out = level_texels(level);
+        for (int y = 0; y < target.height; y++) {
+            for (int x = 0; x < target.width; x++) {
+                out[tiled_index(x, y, target.width_shift)] = average(
+                    in[tiled_index(2 * x, 2 * y, source.width_shift)], in[tiled_index(2 * x + 1, 2 * y, source.width_shift)],
+                    in[tiled_index(2 * x, 2 * y + 1, source.width_shift)], in[tiled_index(2 * x + 1, 2 * y + 1, source.width_shift)]);
+            }
         }
     }
-    free(png_texture);
-    return mesh_texture;
 }
 
+int Texture::select_level(glm::vec2 a_uv, glm::vec2 b_uv, glm::vec2 c_uv, float pixel_area) const
+{
+    if (m_levels.size() == 1 || pixel_area <= 0) {
+        return 0;
+    }
+
+    // Twice the area of the triangle in base level texels
+    glm::vec2 ab = b_uv - a_uv;
+    glm::vec2 ac = c_uv - a_uv;
+    float texel_area = fabsf(ab.x * ac.y - ab.y * ac.x) * m_width * m_height;
+    if (texel_area <= pixel_area) {
+        return 0;
+    }
+
+    // Every level quarters the texel area, round to the nearest level
+    int level = 0.5f * log2f(texel_area / pixel_area) + 0.5f;
+    return level < get_level_count() ? level : get_level_count() - 1;
+}
+
+uint32_t Texture::sample(int level, float u, float v) const
+{
+    if (m_wrap == TextureWrap::Clamp) {
+        return m_power_of_two ? sample<TextureWrap::Clamp, true>(m_levels[level], u, v) : sample<TextureWrap::Clamp, false>(m_levels[level], u, v);
+    }
+    return m_power_of_two ? sample<TextureWrap::Repeat, true>(m_levels[level], u, v) : sample<TextureWrap::Repeat, false>(m_levels[level], u, v);
+}
+
+Texture* load_png_texture_data(std::string filename)
+{
+    upng_t* png_texture = upng_new_from_file(filename.c_str());
+    if (png_texture == NULL) {
+        fprintf(stderr, "Error: could not open texture %s\n", filename.c_str());
+        return nullptr;
+    }
+
+    // Decode straight into the base level of the texture, one row at a time
+    Texture* texture = nullptr;
+    if (upng_header(png_texture) == UPNG_EOK) {
+        texture = new Texture(upng_get_width(png_texture), upng_get_height(png_texture));
+        auto store_row = [](void* user, unsigned y, const uint32_t* pixels) {
+            static_cast<Texture*>(user)->set_row(y, pixels);
+        };
+        if (upng_decode_rows(png_texture, store_row, texture) == UPNG_EOK) {
+            texture->build_mip_chain();
+        } else {
+            delete texture;
+            texture = nullptr;
+        }
+    }
+    if (texture == nullptr) {
+        fprintf(stderr, "Error: could not decode texture %s\n", filename.c_str());
+    }
+    upng_free(png_texture);
+    return texture;
+}
@@ -2,9 +2,121 @@
 
 #include "upng.h"
 #include <stdint.h>
+#include <stdlib.h>
 #include <string>
+#include <vector>
 
-extern int texture_width;
-extern int texture_height;
+#include <glm/vec2.hpp>
 
-uint32_t* load_png_texture_data(std::string filename);
+// How texture coordinates outside of [0, 1) are mapped to texels
+enum class TextureWrap {
+    Repeat, // abs(i) % size, mirrored around zero
+    Clamp   // the edge texels are stretched
+};
+
+// Edge length in texels of the square tiles power of two textures are stored in
+#define TEXTURE_TILE_SIZE 4
+
+// One level of the mip chain
+struct TextureLevel {
+    const uint32_t* texels;
+    int width;
+    int height;
+    int width_shift; // log2(width), only set for power of two textures
+};
+
+/* A 32 bit RGBA texture.
+
+   Power of two textures (at least one tile in each direction) get a full mip chain down to a
+   single tile, built with a box filter when the texture is created. Every level is stored in
+   4x4 tiles of 16 consecutive texels, so the texels around a sample share a cache line or two
+   whatever direction the triangle is walked in. Wrapping is a mask and addressing is shifts.
+
+     row major            tiled
+     00 01 02 03 04 ..    00 01 02 03 | 16 17 18 19
+     .. .. .. .. .. ..    04 05 06 07 | 20 21 22 23
+                          08 09 10 11 | ..
+                          12 13 14 15 |
+
+   Any other size keeps a single row major level and wraps with a division. The samplers are
+   templated on the wrap mode and size class so the inner loops of the rasterizer pick one
+   instantiation per span rather than branching per texel.
+
+   The storage of every level is allocated up front. The base level is written a row at a
+   time, so a decoder can stream into it without an intermediate image, and the rest of the
+   chain is built from it with build_mip_chain. */
+class Texture {
+public:
+    Texture(int width, int height, TextureWrap wrap = TextureWrap::Repeat);
+
+    // The levels point into the texel storage, so a texture can't be copied
+    Texture(const Texture&) = delete;
+    Texture& operator=(const Texture&) = delete;
+
+    int get_width() const { return m_width; }
+    int get_height() const { return m_height; }
+    TextureWrap get_wrap() const { return m_wrap; }
+    // Only changes how the texels are addressed, the storage is the same for every wrap mode
+    void set_wrap(TextureWrap wrap) { m_wrap = wrap; }
+    bool is_power_of_two() const { return m_power_of_two; }
+
+    // Store row y of the base level from width row major texels
+    void set_row(int y, const uint32_t* texels);
+
+    // Fill every smaller level from the one above it, once the base level is complete
+    void build_mip_chain();
+
+    int get_level_count() const { return m_levels.size(); }
+    const TextureLevel& get_level(int level) const { return m_levels[level]; }
+
+    // Pick the mip level for a triangle from how many texels of the base level land on each
+    // pixel. pixel_area is twice the screen space area of the triangle.
+    int select_level(glm::vec2 a_uv, glm::vec2 b_uv, glm::vec2 c_uv, float pixel_area) const;
+
+    // Texel offset of (x, y) inside a tiled level
+    static int tiled_index(int x, int y, int width_shift)
+    {
+        return ((y & ~3) << width_shift) + ((y & 3) << 2) + ((x & ~3) << 2) + (x & 3);
+    }
+
+    template<TextureWrap Wrap, bool PowerOfTwo>
+    static int wrap(float coordinate, int size)
+    {
+        int i = (int)(coordinate * size);
+        if constexpr (Wrap == TextureWrap::Clamp) {
+            return i < 0 ? 0 : (i >= size ? size - 1 : i);
+        } else if constexpr (PowerOfTwo) {
+            return abs(i) & (size - 1);
+        } else {
+            return abs(i) % size;
+        }
+    }
+
+    template<TextureWrap Wrap, bool PowerOfTwo>
+    static uint32_t sample(const TextureLevel& level, float u, float v)
+    {
+        int tex_x = wrap<Wrap, PowerOfTwo>(u, level.width);
+        int tex_y = wrap<Wrap, PowerOfTwo>(v, level.height);
+        if constexpr (PowerOfTwo) {
+            return level.texels[tiled_index(tex_x, tex_y, level.width_shift)];
+        } else {
+            return level.texels[(level.width * tex_y) + tex_x];
+        }
+    }
+
+    // Sample with the texture's own wrap mode, for callers outside of the span kernels
+    uint32_t sample(int level, float u, float v) const;
+
+private:
+    uint32_t* level_texels(int level) { return m_texels.data() + (m_levels[level].texels - m_texels.data()); }
+
+    std::vector<uint32_t> m_texels; // every level, largest first
+    std::vector<TextureLevel> m_levels;
+    int m_width;
+    int m_height;
+    bool m_power_of_two;
+    TextureWrap m_wrap;
+};
+
+// Returns nullptr when the file can't be read or decoded
+Texture* load_png_texture_data(std::string filename);
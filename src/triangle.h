@@ -7,14 +7,9 @@
 
 #include "texture.h"
 
-struct Vertex {
-    glm::vec3 point;
-    glm::vec2 uv;
-};
-
+// Indices of the three corners of a triangle in the mesh vertex arrays
 struct Face {
-    Vertex a, b, c;
-    uint32_t color;
+    uint32_t a, b, c;
 };
 
 struct Triangle {
@@ -25,6 +25,7 @@ freely, subject to the following restrictions:
 */
 
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -47,15 +48,8 @@ freely, subject to the following restrictions:
 #define NUM_CODE_LENGTH_CODES 19     // the code length codes. 0-15: code lengths, 16: copy previous 3-6 times, 17: 3-10 zeros, 18: 11-138 zeros
 #define MAX_SYMBOLS 288              //  largest number of symbols used by any tree type
 
-#define DEFLATE_CODE_BITLEN 15
-#define DISTANCE_BITLEN 15
-#define CODE_LENGTH_BITLEN 7
 #define MAX_BIT_LENGTH 15 // largest bitlen used by any tree type
 
-#define DEFLATE_CODE_BUFFER_SIZE (NUM_DEFLATE_CODE_SYMBOLS * 2)
-#define DISTANCE_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
-#define CODE_LENGTH_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
-
 #define SET_ERROR(upng, code)          \
     do {                               \
         (upng)->error = (code);        \
@@ -104,11 +98,49 @@ struct upng_t {
     upng_source source;
 };
 
-typedef struct huffman_tree {
-    unsigned* tree2d;
-    unsigned maxbitlen; /*maximum number of bits a single code can get */
-    unsigned numcodes;  /*number of symbols in the alphabet = number of codes */
-} huffman_tree;
+/* Huffman codes are decoded with lookup tables indexed by the next bits of the stream.
+   Codes up to root_bits long resolve with a single lookup. Longer codes share a root entry
+   with the other codes of the same prefix, which links to a subtable indexed by the bits
+   that follow. An entry packs:
+     bits 0-7    the number of bits to consume, the code length (minus root_bits inside a
+                 subtable) or for a link the number of bits indexing the subtable
+     bit 8       set when the entry links to a subtable
+     bits 16-31  the symbol, or for a link the offset of the subtable
+   An entry of zero is a code that isn't assigned. */
+#define LITLEN_ROOT_BITS 10
+#define DISTANCE_ROOT_BITS 8
+#define CODE_LENGTH_ROOT_BITS 7
+#define HUFFMAN_TABLE_SIZE 2048 /* root table and subtables, enough for any complete or incomplete code */
+#define HUFFMAN_SUBTABLE 0x100
+
+typedef struct huffman_table {
+    unsigned root_bits;
+    uint32_t entries[HUFFMAN_TABLE_SIZE];
+} huffman_table;
+
+/* LSB first bit reader over the compressed stream, refilled a word at a time. Past the end of
+   the input it reads zeros, uz_inflate_data checks after every block that no padding was consumed. */
+typedef struct bit_reader {
+    const unsigned char* in;
+    unsigned long size;
+    unsigned long pos; /* next byte to load into the buffer, may run past size */
+    uint64_t buffer;
+    unsigned count; /* number of valid bits in buffer */
+} bit_reader;
+
+#define INFLATE_WINDOW_SIZE 32768 /* largest distance a match may reach back */
+#define MAX_MATCH_LENGTH 258
+
+/* Where the inflater stopped, so decoding can resume once the caller made room for more output */
+typedef struct inflate_state {
+    bit_reader reader;
+    huffman_table codetree;
+    huffman_table codetreeD;
+    unsigned btype;            /* type of the current block */
+    unsigned in_block;         /* the current block was started but its end not reached yet */
+    unsigned last_block;       /* the current block is the final one */
+    unsigned long stored_left; /* bytes left to copy of an uncompressed block */
+} inflate_state;
 
 static const unsigned LENGTH_BASE[29] = { /*the base lengths represented by codes 257-285 */
     3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
@@ -133,361 +165,294 @@ static const unsigned DISTANCE_EXTRA[30] = { /*the extra bits of backwards dista
 static const unsigned CLCL[NUM_CODE_LENGTH_CODES] /*the order in which "code length alphabet code lengths" are stored, out of this the huffman tree of the dynamic huffman tree lengths is generated */
     = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
 
-static const unsigned FIXED_DEFLATE_CODE_TREE[NUM_DEFLATE_CODE_SYMBOLS * 2] = {
-    289, 370, 290, 307, 546, 291, 561, 292, 293, 300, 294, 297, 295, 296, 0, 1,
-    2, 3, 298, 299, 4, 5, 6, 7, 301, 304, 302, 303, 8, 9, 10, 11, 305, 306, 12,
-    13, 14, 15, 308, 339, 309, 324, 310, 317, 311, 314, 312, 313, 16, 17, 18,
-    19, 315, 316, 20, 21, 22, 23, 318, 321, 319, 320, 24, 25, 26, 27, 322, 323,
-    28, 29, 30, 31, 325, 332, 326, 329, 327, 328, 32, 33, 34, 35, 330, 331, 36,
-    37, 38, 39, 333, 336, 334, 335, 40, 41, 42, 43, 337, 338, 44, 45, 46, 47,
-    340, 355, 341, 348, 342, 345, 343, 344, 48, 49, 50, 51, 346, 347, 52, 53,
-    54, 55, 349, 352, 350, 351, 56, 57, 58, 59, 353, 354, 60, 61, 62, 63, 356,
-    363, 357, 360, 358, 359, 64, 65, 66, 67, 361, 362, 68, 69, 70, 71, 364,
-    367, 365, 366, 72, 73, 74, 75, 368, 369, 76, 77, 78, 79, 371, 434, 372,
-    403, 373, 388, 374, 381, 375, 378, 376, 377, 80, 81, 82, 83, 379, 380, 84,
-    85, 86, 87, 382, 385, 383, 384, 88, 89, 90, 91, 386, 387, 92, 93, 94, 95,
-    389, 396, 390, 393, 391, 392, 96, 97, 98, 99, 394, 395, 100, 101, 102, 103,
-    397, 400, 398, 399, 104, 105, 106, 107, 401, 402, 108, 109, 110, 111, 404,
-    419, 405, 412, 406, 409, 407, 408, 112, 113, 114, 115, 410, 411, 116, 117,
-    118, 119, 413, 416, 414, 415, 120, 121, 122, 123, 417, 418, 124, 125, 126,
-    127, 420, 427, 421, 424, 422, 423, 128, 129, 130, 131, 425, 426, 132, 133,
-    134, 135, 428, 431, 429, 430, 136, 137, 138, 139, 432, 433, 140, 141, 142,
-    143, 435, 483, 436, 452, 568, 437, 438, 445, 439, 442, 440, 441, 144, 145,
-    146, 147, 443, 444, 148, 149, 150, 151, 446, 449, 447, 448, 152, 153, 154,
-    155, 450, 451, 156, 157, 158, 159, 453, 468, 454, 461, 455, 458, 456, 457,
-    160, 161, 162, 163, 459, 460, 164, 165, 166, 167, 462, 465, 463, 464, 168,
-    169, 170, 171, 466, 467, 172, 173, 174, 175, 469, 476, 470, 473, 471, 472,
-    176, 177, 178, 179, 474, 475, 180, 181, 182, 183, 477, 480, 478, 479, 184,
-    185, 186, 187, 481, 482, 188, 189, 190, 191, 484, 515, 485, 500, 486, 493,
-    487, 490, 488, 489, 192, 193, 194, 195, 491, 492, 196, 197, 198, 199, 494,
-    497, 495, 496, 200, 201, 202, 203, 498, 499, 204, 205, 206, 207, 501, 508,
-    502, 505, 503, 504, 208, 209, 210, 211, 506, 507, 212, 213, 214, 215, 509,
-    512, 510, 511, 216, 217, 218, 219, 513, 514, 220, 221, 222, 223, 516, 531,
-    517, 524, 518, 521, 519, 520, 224, 225, 226, 227, 522, 523, 228, 229, 230,
-    231, 525, 528, 526, 527, 232, 233, 234, 235, 529, 530, 236, 237, 238, 239,
-    532, 539, 533, 536, 534, 535, 240, 241, 242, 243, 537, 538, 244, 245, 246,
-    247, 540, 543, 541, 542, 248, 249, 250, 251, 544, 545, 252, 253, 254, 255,
-    547, 554, 548, 551, 549, 550, 256, 257, 258, 259, 552, 553, 260, 261, 262,
-    263, 555, 558, 556, 557, 264, 265, 266, 267, 559, 560, 268, 269, 270, 271,
-    562, 565, 563, 564, 272, 273, 274, 275, 566, 567, 276, 277, 278, 279, 569,
-    572, 570, 571, 280, 281, 282, 283, 573, 574, 284, 285, 286, 287, 0, 0
-};
-
-static const unsigned FIXED_DISTANCE_TREE[NUM_DISTANCE_SYMBOLS * 2] = {
-    33, 48, 34, 41, 35, 38, 36, 37, 0, 1, 2, 3, 39, 40, 4, 5, 6, 7, 42, 45, 43,
-    44, 8, 9, 10, 11, 46, 47, 12, 13, 14, 15, 49, 56, 50, 53, 51, 52, 16, 17,
-    18, 19, 54, 55, 20, 21, 22, 23, 57, 60, 58, 59, 24, 25, 26, 27, 61, 62, 28,
-    29, 30, 31, 0, 0
-};
+/* make sure the buffer holds at least 56 bits */
+static void bit_reader_refill(bit_reader* reader)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (reader->pos + 8 <= reader->size) {
+        uint64_t word;
+        memcpy(&word, reader->in + reader->pos, 8);
+        reader->buffer |= word << reader->count;
+        reader->pos += (63 - reader->count) >> 3;
+        reader->count |= 56;
+        return;
+    }
+#endif
+    while (reader->count <= 56) {
+        if (reader->pos < reader->size) {
+            reader->buffer |= (uint64_t)reader->in[reader->pos] << reader->count;
+        }
+        reader->pos++;
+        reader->count += 8;
+    }
+}
 
-static unsigned char read_bit(unsigned long* bitpointer, const unsigned char* bitstream)
+static void bit_reader_consume(bit_reader* reader, unsigned nbits)
 {
-    unsigned char result = (unsigned char)((bitstream[(*bitpointer) >> 3] >> ((*bitpointer) & 0x7)) & 1);
-    (*bitpointer)++;
-    return result;
+    reader->buffer >>= nbits;
+    reader->count -= nbits;
 }
 
-static unsigned read_bits(unsigned long* bitpointer, const unsigned char* bitstream, unsigned long nbits)
+/* read up to 32 bits */
+static unsigned read_bits(bit_reader* reader, unsigned nbits)
 {
-    unsigned result = 0, i;
-    for (i = 0; i < nbits; i++)
-        result |= ((unsigned)read_bit(bitpointer, bitstream)) << i;
+    unsigned result;
+    if (reader->count < nbits) {
+        bit_reader_refill(reader);
+    }
+    result = (unsigned)(reader->buffer & ((1ull << nbits) - 1));
+    bit_reader_consume(reader, nbits);
     return result;
 }
 
-/* the buffer must be numcodes*2 in size! */
-static void huffman_tree_init(huffman_tree* tree, unsigned* buffer, unsigned numcodes, unsigned maxbitlen)
+/* true when more bits were consumed than the input holds */
+static int bit_reader_overrun(const bit_reader* reader)
 {
-    tree->tree2d = buffer;
+    return reader->pos * 8 - reader->count > reader->size * 8;
+}
 
-    tree->numcodes = numcodes;
-    tree->maxbitlen = maxbitlen;
+static unsigned reverse_bits(unsigned code, unsigned nbits)
+{
+    unsigned result = 0, i;
+    for (i = 0; i < nbits; i++) {
+        result = (result << 1) | (code & 1);
+        code >>= 1;
+    }
+    return result;
 }
 
-/*given the code lengths (as stored in the PNG file), generate the tree as defined by Deflate. maxbitlen is the maximum bits that a code in the tree can have. return value is error.*/
-static void huffman_tree_create_lengths(upng_t* upng, huffman_tree* tree, const unsigned* bitlen)
+/*given the code lengths (as stored in the PNG file), generate the lookup table as defined by Deflate*/
+static void huffman_table_create(upng_t* upng, huffman_table* table, const unsigned* bitlen, unsigned numcodes, unsigned root_bits)
 {
-    unsigned tree1d[MAX_SYMBOLS];
-    unsigned blcount[MAX_BIT_LENGTH];
+    unsigned blcount[MAX_BIT_LENGTH + 1];
     unsigned nextcode[MAX_BIT_LENGTH + 1];
+    unsigned reversed[MAX_SYMBOLS];
+    unsigned subtable_bits[1 << LITLEN_ROOT_BITS];
+    unsigned root_size = 1u << root_bits;
+    unsigned next_free = root_size;
+    long left = 1;
     unsigned bits, n, i;
-    unsigned nodefilled = 0; /*up to which node it is filled */
-    unsigned treepos = 0;    /*position in the tree (1 of the numcodes columns) */
 
-    /* initialize local vectors */
-    memset(blcount, 0, sizeof(blcount));
-    memset(nextcode, 0, sizeof(nextcode));
+    table->root_bits = root_bits;
 
     /*step 1: count number of instances of each code length */
-    for (bits = 0; bits < tree->numcodes; bits++) {
-        blcount[bitlen[bits]]++;
+    memset(blcount, 0, sizeof(blcount));
+    for (n = 0; n < numcodes; n++) {
+        blcount[bitlen[n]]++;
+    }
+    blcount[0] = 0;
+
+    /* over-subscribed codes can't be decoded, incomplete ones are allowed */
+    for (bits = 1; bits <= MAX_BIT_LENGTH; bits++) {
+        left = (left << 1) - blcount[bits];
+        if (left < 0) {
+            SET_ERROR(upng, UPNG_EMALFORMED);
+            return;
+        }
     }
 
     /*step 2: generate the nextcode values */
-    for (bits = 1; bits <= tree->maxbitlen; bits++) {
+    nextcode[0] = 0;
+    for (bits = 1; bits <= MAX_BIT_LENGTH; bits++) {
         nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1]) << 1;
     }
 
-    /*step 3: generate all the codes */
-    for (n = 0; n < tree->numcodes; n++) {
+    /*step 3: generate all the codes, reversed since the stream is read from the least significant bit */
+    for (n = 0; n < numcodes; n++) {
         if (bitlen[n] != 0) {
-            tree1d[n] = nextcode[bitlen[n]]++;
+            reversed[n] = reverse_bits(nextcode[bitlen[n]]++, bitlen[n]);
         }
     }
 
-    /*convert tree1d[] to tree2d[][]. In the 2D array, a value of 32767 means uninited, a value >= numcodes is an address to another bit, a value < numcodes is a code. The 2 rows are the 2 possible bit values (0 or 1), there are as many columns as codes - 1
-           a good huffmann tree has N * 2 - 1 nodes, of which N - 1 are internal nodes. Here, the internal nodes are stored (what their 0 and 1 option point to). There is only memory for such good tree currently, if there are more nodes (due to too long length codes), error 55 will happen */
-    for (n = 0; n < tree->numcodes * 2; n++) {
-        tree->tree2d[n] = 32767; /*32767 here means the tree2d isn't filled there yet */
+    /*step 4: size every subtable after the longest code sharing its root prefix */
+    memset(table->entries, 0, root_size * sizeof(table->entries[0]));
+    memset(subtable_bits, 0, root_size * sizeof(subtable_bits[0]));
+    for (n = 0; n < numcodes; n++) {
+        if (bitlen[n] > root_bits) {
+            unsigned prefix = reversed[n] & (root_size - 1);
+            if (bitlen[n] - root_bits > subtable_bits[prefix]) {
+                subtable_bits[prefix] = bitlen[n] - root_bits;
+            }
+        }
     }
-
-    for (n = 0; n < tree->numcodes; n++) { /*the codes */
-        for (i = 0; i < bitlen[n]; i++) {  /*the bits for this code */
-            unsigned char bit = (unsigned char)((tree1d[n] >> (bitlen[n] - i - 1)) & 1);
-            /* check if oversubscribed */
-            if (treepos > tree->numcodes - 2) {
+    for (i = 0; i < root_size; i++) {
+        if (subtable_bits[i] != 0) {
+            unsigned size = 1u << subtable_bits[i];
+            if (next_free + size > HUFFMAN_TABLE_SIZE) {
                 SET_ERROR(upng, UPNG_EMALFORMED);
                 return;
             }
-
-            if (tree->tree2d[2 * treepos + bit] == 32767) { /*not yet filled in */
-                if (i + 1 == bitlen[n]) {                   /*last bit */
-                    tree->tree2d[2 * treepos + bit] = n;    /*put the current code in it */
-                    treepos = 0;
-                } else { /*put address of the next step in here, first that address has to be found of course (it's just nodefilled + 1)... */
-                    nodefilled++;
-                    tree->tree2d[2 * treepos + bit] = nodefilled + tree->numcodes; /*addresses encoded with numcodes added to it */
-                    treepos = nodefilled;
-                }
-            } else {
-                treepos = tree->tree2d[2 * treepos + bit] - tree->numcodes;
-            }
+            memset(&table->entries[next_free], 0, size * sizeof(table->entries[0]));
+            table->entries[i] = (next_free << 16) | HUFFMAN_SUBTABLE | subtable_bits[i];
+            next_free += size;
         }
     }
 
-    for (n = 0; n < tree->numcodes * 2; n++) {
-        if (tree->tree2d[n] == 32767) {
-            tree->tree2d[n] = 0; /*remove possible remaining 32767's */
+    /*step 5: fill every slot whose low bits match a code with that code's symbol */
+    for (n = 0; n < numcodes; n++) {
+        unsigned length = bitlen[n];
+        if (length == 0) {
+            continue;
+        }
+
+        if (length <= root_bits) {
+            for (i = reversed[n]; i < root_size; i += 1u << length) {
+                table->entries[i] = (n << 16) | length;
+            }
+        } else {
+            uint32_t link = table->entries[reversed[n] & (root_size - 1)];
+            unsigned offset = link >> 16;
+            unsigned size = 1u << (link & 0xFF);
+            unsigned sublength = length - root_bits;
+            for (i = reversed[n] >> root_bits; i < size; i += 1u << sublength) {
+                table->entries[offset + i] = (n << 16) | sublength;
+            }
         }
     }
 }
 
-static unsigned huffman_decode_symbol(upng_t* upng, const unsigned char* in, unsigned long* bp, const huffman_tree* codetree, unsigned long inlength)
+static unsigned huffman_decode_symbol(upng_t* upng, bit_reader* reader, const huffman_table* table)
 {
-    unsigned treepos = 0, ct;
-    unsigned char bit;
-    for (;;) {
-        /* error: end of input memory reached without endcode */
-        if (((*bp) & 0x07) == 0 && ((*bp) >> 3) > inlength) {
-            SET_ERROR(upng, UPNG_EMALFORMED);
-            return 0;
-        }
+    uint32_t entry;
 
-        bit = read_bit(bp, in);
+    if (reader->count < MAX_BIT_LENGTH) {
+        bit_reader_refill(reader);
+    }
 
-        ct = codetree->tree2d[(treepos << 1) | bit];
-        if (ct < codetree->numcodes) {
-            return ct;
-        }
+    entry = table->entries[reader->buffer & ((1u << table->root_bits) - 1)];
+    if (entry & HUFFMAN_SUBTABLE) {
+        bit_reader_consume(reader, table->root_bits);
+        entry = table->entries[(entry >> 16) + (reader->buffer & ((1u << (entry & 0xFF)) - 1))];
+    }
 
-        treepos = ct - codetree->numcodes;
-        if (treepos >= codetree->numcodes) {
-            SET_ERROR(upng, UPNG_EMALFORMED);
-            return 0;
-        }
+    /* error: a code that isn't in the tree, or the end of input was reached without an end code */
+    if ((entry & 0xFF) == 0 || (reader->pos > reader->size && bit_reader_overrun(reader))) {
+        SET_ERROR(upng, UPNG_EMALFORMED);
+        return 0;
     }
+
+    bit_reader_consume(reader, entry & 0xFF);
+    return entry >> 16;
 }
 
 /* get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
-static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffman_tree* codetreeD, huffman_tree* codelengthcodetree, const unsigned char* in, unsigned long* bp, unsigned long inlength)
+static void get_tree_inflate_dynamic(upng_t* upng, huffman_table* codetree, huffman_table* codetreeD, bit_reader* reader)
 {
+    huffman_table codelengthcodetree;
     unsigned codelengthcode[NUM_CODE_LENGTH_CODES];
-    unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
-    unsigned bitlenD[NUM_DISTANCE_SYMBOLS];
+    unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS + NUM_DISTANCE_SYMBOLS];
     unsigned n, hlit, hdist, hclen, i;
 
     /*make sure that length values that aren't filled in will be 0, or a wrong tree will be generated */
-    /*C-code note: use no "return" between ctor and dtor of an uivector! */
-    if ((*bp) >> 3 >= inlength - 2) {
+    memset(bitlen, 0, sizeof(bitlen));
+
+    hlit = read_bits(reader, 5) + 257; /*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already */
+    hdist = read_bits(reader, 5) + 1;  /*number of distance codes. Unlike the spec, the value 1 is added to it here already */
+    hclen = read_bits(reader, 4) + 4;  /*number of code length codes. Unlike the spec, the value 4 is added to it here already */
+
+    if (hlit > NUM_DEFLATE_CODE_SYMBOLS || hdist > NUM_DISTANCE_SYMBOLS) {
         SET_ERROR(upng, UPNG_EMALFORMED);
         return;
     }
 
-    /* clear bitlen arrays */
-    memset(bitlen, 0, sizeof(bitlen));
-    memset(bitlenD, 0, sizeof(bitlenD));
-
-    /*the bit pointer is or will go past the memory */
-    hlit = read_bits(bp, in, 5) + 257; /*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already */
-    hdist = read_bits(bp, in, 5) + 1;  /*number of distance codes. Unlike the spec, the value 1 is added to it here already */
-    hclen = read_bits(bp, in, 4) + 4;  /*number of code length codes. Unlike the spec, the value 4 is added to it here already */
-
     for (i = 0; i < NUM_CODE_LENGTH_CODES; i++) {
         if (i < hclen) {
-            codelengthcode[CLCL[i]] = read_bits(bp, in, 3);
+            codelengthcode[CLCL[i]] = read_bits(reader, 3);
         } else {
             codelengthcode[CLCL[i]] = 0; /*if not, it must stay 0 */
         }
     }
 
-    huffman_tree_create_lengths(upng, codelengthcodetree, codelengthcode);
+    huffman_table_create(upng, &codelengthcodetree, codelengthcode, NUM_CODE_LENGTH_CODES, CODE_LENGTH_ROOT_BITS);
 
     /* bail now if we encountered an error earlier */
     if (upng->error != UPNG_EOK) {
         return;
     }
 
-    /*now we can use this tree to read the lengths for the tree that this function will return */
+    /*now we can use this tree to read the lengths for the tree that this function will return. The literal/length
+      and distance code lengths form one sequence, a repeat may run from one into the other */
     i = 0;
-    while (i < hlit + hdist) { /*i is the current symbol we're reading in the part that contains the code lengths of lit/len codes and dist codes */
-        unsigned code = huffman_decode_symbol(upng, in, bp, codelengthcodetree, inlength);
+    while (i < hlit + hdist) {
+        unsigned code = huffman_decode_symbol(upng, reader, &codelengthcodetree);
+        unsigned replength, value;
         if (upng->error != UPNG_EOK) {
-            break;
+            return;
         }
 
         if (code <= 15) { /*a length code */
-            if (i < hlit) {
-                bitlen[i] = code;
-            } else {
-                bitlenD[i - hlit] = code;
-            }
-            i++;
-        } else if (code == 16) {    /*repeat previous */
-            unsigned replength = 3; /*read in the 2 bits that indicate repeat length (3-6) */
-            unsigned value;         /*set value to the previous code */
-
-            if ((*bp) >> 3 >= inlength) {
-                SET_ERROR(upng, UPNG_EMALFORMED);
-                break;
-            }
-            /*error, bit pointer jumps past memory */
-            replength += read_bits(bp, in, 2);
-
-            if ((i - 1) < hlit) {
-                value = bitlen[i - 1];
-            } else {
-                value = bitlenD[i - hlit - 1];
-            }
-
-            /*repeat this value in the next lengths */
-            for (n = 0; n < replength; n++) {
-                /* i is larger than the amount of codes */
-                if (i >= hlit + hdist) {
-                    SET_ERROR(upng, UPNG_EMALFORMED);
-                    break;
-                }
-
-                if (i < hlit) {
-                    bitlen[i] = value;
-                } else {
-                    bitlenD[i - hlit] = value;
-                }
-                i++;
-            }
-        } else if (code == 17) {    /*repeat "0" 3-10 times */
-            unsigned replength = 3; /*read in the bits that indicate repeat length */
-            if ((*bp) >> 3 >= inlength) {
-                SET_ERROR(upng, UPNG_EMALFORMED);
-                break;
-            }
-
-            /*error, bit pointer jumps past memory */
-            replength += read_bits(bp, in, 3);
-
-            /*repeat this value in the next lengths */
-            for (n = 0; n < replength; n++) {
-                /* error: i is larger than the amount of codes */
-                if (i >= hlit + hdist) {
-                    SET_ERROR(upng, UPNG_EMALFORMED);
-                    break;
-                }
+            bitlen[i++] = code;
+            continue;
+        }
 
-                if (i < hlit) {
-                    bitlen[i] = 0;
-                } else {
-                    bitlenD[i - hlit] = 0;
-                }
-                i++;
-            }
-        } else if (code == 18) {     /*repeat "0" 11-138 times */
-            unsigned replength = 11; /*read in the bits that indicate repeat length */
-            /* error, bit pointer jumps past memory */
-            if ((*bp) >> 3 >= inlength) {
+        if (code == 16) { /*repeat previous 3-6 times */
+            if (i == 0) {
                 SET_ERROR(upng, UPNG_EMALFORMED);
-                break;
+                return;
             }
+            replength = 3 + read_bits(reader, 2);
+            value = bitlen[i - 1];
+        } else if (code == 17) { /*repeat "0" 3-10 times */
+            replength = 3 + read_bits(reader, 3);
+            value = 0;
+        } else { /*code 18, repeat "0" 11-138 times */
+            replength = 11 + read_bits(reader, 7);
+            value = 0;
+        }
 
-            replength += read_bits(bp, in, 7);
-
-            /*repeat this value in the next lengths */
-            for (n = 0; n < replength; n++) {
-                /* i is larger than the amount of codes */
-                if (i >= hlit + hdist) {
-                    SET_ERROR(upng, UPNG_EMALFORMED);
-                    break;
-                }
-                if (i < hlit)
-                    bitlen[i] = 0;
-                else
-                    bitlenD[i - hlit] = 0;
-                i++;
-            }
-        } else {
-            /* somehow an unexisting code appeared. This can never happen. */
+        /* error: i is larger than the amount of codes */
+        if (i + replength > hlit + hdist) {
             SET_ERROR(upng, UPNG_EMALFORMED);
-            break;
+            return;
+        }
+        for (n = 0; n < replength; n++) {
+            bitlen[i++] = value;
         }
     }
 
-    if (upng->error == UPNG_EOK && bitlen[256] == 0) {
+    /*the length of the end code 256 must be larger than 0 */
+    if (bitlen[256] == 0) {
         SET_ERROR(upng, UPNG_EMALFORMED);
+        return;
     }
 
-    /*the length of the end code 256 must be larger than 0 */
     /*now we've finally got hlit and hdist, so generate the code trees, and the function is done */
+    huffman_table_create(upng, codetree, bitlen, hlit, LITLEN_ROOT_BITS);
     if (upng->error == UPNG_EOK) {
-        huffman_tree_create_lengths(upng, codetree, bitlen);
+        huffman_table_create(upng, codetreeD, bitlen + hlit, hdist, DISTANCE_ROOT_BITS);
     }
-    if (upng->error == UPNG_EOK) {
-        huffman_tree_create_lengths(upng, codetreeD, bitlenD);
+}
+
+/* the tables of the fixed Huffman codes of btype 1 */
+static void get_tree_inflate_fixed(upng_t* upng, huffman_table* codetree, huffman_table* codetreeD)
+{
+    unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
+    unsigned bitlenD[NUM_DISTANCE_SYMBOLS];
+    unsigned i;
+
+    for (i = 0; i < NUM_DEFLATE_CODE_SYMBOLS; i++) {
+        bitlen[i] = i < 144 ? 8 : (i < 256 ? 9 : (i < 280 ? 7 : 8));
+    }
+    for (i = 0; i < NUM_DISTANCE_SYMBOLS; i++) {
+        bitlenD[i] = 5;
     }
+
+    huffman_table_create(upng, codetree, bitlen, NUM_DEFLATE_CODE_SYMBOLS, LITLEN_ROOT_BITS);
+    huffman_table_create(upng, codetreeD, bitlenD, NUM_DISTANCE_SYMBOLS, DISTANCE_ROOT_BITS);
 }
 
-/*inflate a block with dynamic of fixed Huffman tree*/
-static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char* in, unsigned long* bp, unsigned long* pos, unsigned long inlength, unsigned btype)
+/*inflate the codes of a block with dynamic of fixed Huffman tree, until the end code or until target bytes of output exist*/
+static void inflate_huffman(upng_t* upng, inflate_state* state, unsigned char* out, unsigned long outsize, unsigned long* pos, unsigned long target)
 {
-    unsigned codetree_buffer[DEFLATE_CODE_BUFFER_SIZE];
-    unsigned codetreeD_buffer[DISTANCE_BUFFER_SIZE];
-    unsigned done = 0;
-
-    huffman_tree codetree;
-    huffman_tree codetreeD;
-
-    if (btype == 1) {
-        /* fixed trees */
-        huffman_tree_init(&codetree, (unsigned*)FIXED_DEFLATE_CODE_TREE, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
-        huffman_tree_init(&codetreeD, (unsigned*)FIXED_DISTANCE_TREE, NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
-    } else if (btype == 2) {
-        /* dynamic trees */
-        unsigned codelengthcodetree_buffer[CODE_LENGTH_BUFFER_SIZE];
-        huffman_tree codelengthcodetree;
-
-        huffman_tree_init(&codetree, codetree_buffer, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
-        huffman_tree_init(&codetreeD, codetreeD_buffer, NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
-        huffman_tree_init(&codelengthcodetree, codelengthcodetree_buffer, NUM_CODE_LENGTH_CODES, CODE_LENGTH_BITLEN);
-        get_tree_inflate_dynamic(upng, &codetree, &codetreeD, &codelengthcodetree, in, bp, inlength);
-    }
-
-    while (done == 0) {
-        unsigned code = huffman_decode_symbol(upng, in, bp, &codetree, inlength);
+    bit_reader* reader = &state->reader;
+
+    while ((*pos) < target) {
+        unsigned code = huffman_decode_symbol(upng, reader, &state->codetree);
         if (upng->error != UPNG_EOK) {
             return;
         }
 
-        if (code == 256) {
-            /* end code */
-            done = 1;
-        } else if (code <= 255) {
+        if (code <= 255) {
             /* literal symbol */
             if ((*pos) >= outsize) {
                 SET_ERROR(upng, UPNG_EMALFORMED);
@@ -496,24 +461,21 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 
             /* store output */
             out[(*pos)++] = (unsigned char)(code);
-        } else if (code >= FIRST_LENGTH_CODE_INDEX && code <= LAST_LENGTH_CODE_INDEX) { /*length code */
-            /* part 1: get length base */
-            unsigned long length = LENGTH_BASE[code - FIRST_LENGTH_CODE_INDEX];
-            unsigned codeD, distance, numextrabitsD;
-            unsigned long start, forward, backward, numextrabits;
+        } else if (code == 256) {
+            /* end code */
+            state->in_block = 0;
+            return;
+        } else if (code <= LAST_LENGTH_CODE_INDEX) { /*length code */
+            unsigned long length, distance;
+            unsigned codeD;
+            unsigned char* dst;
+            const unsigned char* src;
 
-            /* part 2: get extra bits and add the value of that to length */
-            numextrabits = LENGTH_EXTRA[code - FIRST_LENGTH_CODE_INDEX];
-
-            /* error, bit pointer will jump past memory */
-            if (((*bp) >> 3) >= inlength) {
-                SET_ERROR(upng, UPNG_EMALFORMED);
-                return;
-            }
-            length += read_bits(bp, in, numextrabits);
+            /* part 1 and 2: get length base and add the value of the extra bits */
+            length = LENGTH_BASE[code - FIRST_LENGTH_CODE_INDEX] + read_bits(reader, LENGTH_EXTRA[code - FIRST_LENGTH_CODE_INDEX]);
 
             /*part 3: get distance code */
-            codeD = huffman_decode_symbol(upng, in, bp, &codetreeD, inlength);
+            codeD = huffman_decode_symbol(upng, reader, &state->codetreeD);
             if (upng->error != UPNG_EOK) {
                 return;
             }
@@ -524,60 +486,65 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
                 return;
             }
 
-            distance = DISTANCE_BASE[codeD];
-
             /*part 4: get extra bits from distance */
-            numextrabitsD = DISTANCE_EXTRA[codeD];
+            distance = DISTANCE_BASE[codeD] + read_bits(reader, DISTANCE_EXTRA[codeD]);
 
-            /* error, bit pointer will jump past memory */
-            if (((*bp) >> 3) >= inlength) {
+            /* the match must start inside the output and end inside the buffer */
+            if (distance > (*pos) || (*pos) + length > outsize) {
                 SET_ERROR(upng, UPNG_EMALFORMED);
                 return;
             }
 
-            distance += read_bits(bp, in, numextrabitsD);
-
-            /*part 5: fill in all the out[n] values based on the length and dist */
-            start = (*pos);
-            backward = start - distance;
-
-            if ((*pos) + length >= outsize) {
-                SET_ERROR(upng, UPNG_EMALFORMED);
-                return;
-            }
-
-            for (forward = 0; forward < length; forward++) {
-                out[(*pos)++] = out[backward];
-                backward++;
-
-                if (backward >= start) {
-                    backward = start - distance;
+            /*part 5: copy length bytes from distance bytes back. When the source is at least a word behind,
+              whole words can be copied; the last one may write past the match, into bytes not produced yet */
+            dst = out + (*pos);
+            src = dst - distance;
+            if (distance >= 8 && (*pos) + length + 8 <= outsize) {
+                unsigned char* end = dst + length;
+                do {
+                    memcpy(dst, src, 8);
+                    dst += 8;
+                    src += 8;
+                } while (dst < end);
+            } else if (distance == 1) {
+                memset(dst, *src, length);
+            } else {
+                unsigned long n;
+                for (n = 0; n < length; n++) {
+                    dst[n] = src[n];
                 }
             }
+            (*pos) += length;
+        } else {
+            /* codes 286 and 287 are never used */
+            SET_ERROR(upng, UPNG_EMALFORMED);
+            return;
         }
     }
 }
 
-static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char* in, unsigned long* bp, unsigned long* pos, unsigned long inlength)
+/*read the header of an uncompressed block, the reader is left at the first byte of the data*/
+static void start_uncompressed(upng_t* upng, inflate_state* state)
 {
+    bit_reader* reader = &state->reader;
     unsigned long p;
-    unsigned len, nlen, n;
+    unsigned len, nlen;
 
-    /* go to first boundary of byte */
-    while (((*bp) & 0x7) != 0) {
-        (*bp)++;
-    }
-    p = (*bp) / 8; /*byte position */
+    /* go to first boundary of byte, then continue at the first byte not consumed yet */
+    bit_reader_consume(reader, reader->count & 7);
+    p = reader->pos - reader->count / 8;
+    reader->buffer = 0;
+    reader->count = 0;
 
     /* read len (2 bytes) and nlen (2 bytes) */
-    if (p >= inlength - 4) {
+    if (p + 4 > reader->size) {
         SET_ERROR(upng, UPNG_EMALFORMED);
         return;
     }
 
-    len = in[p] + 256 * in[p + 1];
+    len = reader->in[p] + 256 * reader->in[p + 1];
     p += 2;
-    nlen = in[p] + 256 * in[p + 1];
+    nlen = reader->in[p] + 256 * reader->in[p + 1];
     p += 2;
 
     /* check if 16-bit nlen is really the one's complement of len */
@@ -586,65 +553,43 @@ static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long
         return;
     }
 
-    if ((*pos) + len >= outsize) {
+    /* the literal data must be inside the input */
+    if (p + len > reader->size) {
         SET_ERROR(upng, UPNG_EMALFORMED);
         return;
     }
 
-    /* read the literal data: len bytes are now stored in the out buffer */
-    if (p + len > inlength) {
-        SET_ERROR(upng, UPNG_EMALFORMED);
-        return;
-    }
-
-    for (n = 0; n < len; n++) {
-        out[(*pos)++] = in[p++];
-    }
-
-    (*bp) = p * 8;
+    reader->pos = p;
+    state->stored_left = len;
 }
 
-/*inflate the deflated data (cfr. deflate spec); return value is the error*/
-static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char* in, unsigned long insize, unsigned long inpos)
+/*copy the data of an uncompressed block, until its end or until target bytes of output exist*/
+static void inflate_uncompressed(upng_t* upng, inflate_state* state, unsigned char* out, unsigned long outsize, unsigned long* pos, unsigned long target)
 {
-    unsigned long bp = 0;  /*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte) */
-    unsigned long pos = 0; /*byte position in the out buffer */
-
-    unsigned done = 0;
-
-    while (done == 0) {
-        unsigned btype;
+    bit_reader* reader = &state->reader;
+    unsigned long len = state->stored_left;
 
-        /* ensure next bit doesn't point past the end of the buffer */
-        if ((bp >> 3) >= insize) {
-            SET_ERROR(upng, UPNG_EMALFORMED);
-            return upng->error;
-        }
+    if (len > target - (*pos)) {
+        len = target - (*pos);
+    }
 
-        /* read block control bits */
-        done = read_bit(&bp, &in[inpos]);
-        btype = read_bit(&bp, &in[inpos]) | (read_bit(&bp, &in[inpos]) << 1);
+    if ((*pos) + len > outsize) {
+        SET_ERROR(upng, UPNG_EMALFORMED);
+        return;
+    }
 
-        /* process control type appropriateyly */
-        if (btype == 3) {
-            SET_ERROR(upng, UPNG_EMALFORMED);
-            return upng->error;
-        } else if (btype == 0) {
-            inflate_uncompressed(upng, out, outsize, &in[inpos], &bp, &pos, insize); /*no compression */
-        } else {
-            inflate_huffman(upng, out, outsize, &in[inpos], &bp, &pos, insize, btype); /*compression, btype 01 or 10 */
-        }
+    memcpy(out + (*pos), reader->in + reader->pos, len);
+    (*pos) += len;
+    reader->pos += len;
 
-        /* stop if an error has occured */
-        if (upng->error != UPNG_EOK) {
-            return upng->error;
-        }
+    state->stored_left -= len;
+    if (state->stored_left == 0) {
+        state->in_block = 0;
     }
-
-    return upng->error;
 }
 
-static upng_error uz_inflate(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char* in, unsigned long insize)
+/*check the zlib header of the stream in and get ready to inflate the deflated data after it*/
+static upng_error uz_inflate_init(upng_t* upng, inflate_state* state, const unsigned char* in, unsigned long insize)
 {
     /* we require two bytes for the zlib data header */
     if (insize < 2) {
@@ -670,8 +615,73 @@ static upng_error uz_inflate(upng_t* upng, unsigned char* out, unsigned long out
         return upng->error;
     }
 
-    /* create output buffer */
-    uz_inflate_data(upng, out, outsize, in, insize, 2);
+    state->reader.in = in + 2;
+    state->reader.size = insize - 2;
+    state->reader.pos = 0;
+    state->reader.buffer = 0;
+    state->reader.count = 0;
+    state->btype = 0;
+    state->in_block = 0;
+    state->last_block = 0;
+    state->stored_left = 0;
+
+    return upng->error;
+}
+
+/*inflate the deflated data (cfr. deflate spec) into out until at least target bytes of it exist, or the stream ends.
+  A Huffman block may overshoot target by up to one match. The LZ77 window is the output itself, so when decoding
+  resumes out must still hold the last INFLATE_WINDOW_SIZE bytes before pos. return value is the error*/
+static upng_error uz_inflate_data(upng_t* upng, inflate_state* state, unsigned char* out, unsigned long outsize, unsigned long* pos, unsigned long target)
+{
+    bit_reader* reader = &state->reader;
+
+    while ((*pos) < target) {
+        if (!state->in_block) {
+            /* the final block is done */
+            if (state->last_block) {
+                break;
+            }
+
+            /* read block control bits */
+            state->last_block = read_bits(reader, 1);
+            state->btype = read_bits(reader, 2);
+
+            /* ensure the block header wasn't read from past the end of the buffer */
+            if (bit_reader_overrun(reader)) {
+                SET_ERROR(upng, UPNG_EMALFORMED);
+                return upng->error;
+            }
+
+            /* process control type appropriateyly */
+            if (state->btype == 3) {
+                SET_ERROR(upng, UPNG_EMALFORMED);
+            } else if (state->btype == 0) {
+                start_uncompressed(upng, state); /*no compression */
+            } else if (state->btype == 1) {
+                get_tree_inflate_fixed(upng, &state->codetree, &state->codetreeD); /*compression with the fixed tree */
+            } else {
+                get_tree_inflate_dynamic(upng, &state->codetree, &state->codetreeD, reader); /*compression with a dynamic tree */
+            }
+            if (upng->error != UPNG_EOK) {
+                return upng->error;
+            }
+            state->in_block = 1;
+        }
+
+        if (state->btype == 0) {
+            inflate_uncompressed(upng, state, out, outsize, pos, target);
+        } else {
+            inflate_huffman(upng, state, out, outsize, pos, target);
+        }
+
+        /* stop if an error has occured, or if the block consumed bits past the end of the input */
+        if (upng->error == UPNG_EOK && bit_reader_overrun(reader)) {
+            SET_ERROR(upng, UPNG_EMALFORMED);
+        }
+        if (upng->error != UPNG_EOK) {
+            return upng->error;
+        }
+    }
 
     return upng->error;
 }
@@ -965,38 +975,16 @@ upng_error upng_header(upng_t* upng)
     return upng->error;
 }
 
-/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
-upng_error upng_decode(upng_t* upng)
+/*collect the payload of every IDAT chunk into one contiguous zlib stream and return it. An owned source buffer is
+  compacted in place, it is released after decoding anyway; otherwise the data is copied into a new allocation
+  returned in copy, which the caller frees*/
+static const unsigned char* upng_idat_stream(upng_t* upng, unsigned long* size, unsigned char** copy)
 {
     const unsigned char* chunk;
     unsigned char* compressed;
-    unsigned char* inflated;
     unsigned long compressed_size = 0, compressed_index = 0;
-    unsigned long inflated_size;
-    upng_error error;
-
-    /* if we have an error state, bail now */
-    if (upng->error != UPNG_EOK) {
-        return upng->error;
-    }
 
-    /* parse the main header, if necessary */
-    upng_header(upng);
-    if (upng->error != UPNG_EOK) {
-        return upng->error;
-    }
-
-    /* if the state is not HEADER (meaning we are ready to decode the image), stop now */
-    if (upng->state != UPNG_HEADER) {
-        return upng->error;
-    }
-
-    /* release old result, if any */
-    if (upng->buffer != 0) {
-        free(upng->buffer);
-        upng->buffer = 0;
-        upng->size = 0;
-    }
+    *copy = NULL;
 
     /* first byte of the first chunk after the header */
     chunk = upng->source.buffer + 33;
@@ -1009,20 +997,20 @@ upng_error upng_decode(upng_t* upng)
         /* make sure chunk header is not larger than the total compressed */
         if ((unsigned long)(chunk - upng->source.buffer + 12) > upng->source.size) {
             SET_ERROR(upng, UPNG_EMALFORMED);
-            return upng->error;
+            return NULL;
         }
 
         /* get length; sanity check it */
         length = upng_chunk_length(chunk);
         if (length > INT_MAX) {
             SET_ERROR(upng, UPNG_EMALFORMED);
-            return upng->error;
+            return NULL;
         }
 
         /* make sure chunk header+paylaod is not larger than the total compressed */
         if ((unsigned long)(chunk - upng->source.buffer + length + 12) > upng->source.size) {
             SET_ERROR(upng, UPNG_EMALFORMED);
-            return upng->error;
+            return NULL;
         }
 
         /* parse chunks */
@@ -1032,17 +1020,24 @@ upng_error upng_decode(upng_t* upng)
             break;
         } else if (upng_chunk_critical(chunk)) {
             SET_ERROR(upng, UPNG_EUNSUPPORTED);
-            return upng->error;
+            return NULL;
         }
 
         chunk += upng_chunk_length(chunk) + 12;
     }
 
-    /* allocate enough space for the (compressed and filtered) image data */
-    compressed = (unsigned char*)malloc(compressed_size);
-    if (compressed == NULL) {
-        SET_ERROR(upng, UPNG_ENOMEM);
-        return upng->error;
+    if (upng->source.owning) {
+        /* the data only ever moves towards the start of the buffer, so the chunk headers
+           ahead of it are still intact when they are read */
+        compressed = (unsigned char*)upng->source.buffer;
+    } else {
+        /* allocate enough space for the (compressed and filtered) image data */
+        compressed = (unsigned char*)malloc(compressed_size);
+        if (compressed == NULL) {
+            SET_ERROR(upng, UPNG_ENOMEM);
+            return NULL;
+        }
+        *copy = compressed;
     }
 
     /* scan through the chunks again, this time copying the values into
@@ -1051,46 +1046,95 @@ upng_error upng_decode(upng_t* upng)
     while (chunk < upng->source.buffer + upng->source.size) {
         unsigned long length;
         const unsigned char* data; /*the data in the chunk */
+        unsigned long type;
 
         length = upng_chunk_length(chunk);
+        type = upng_chunk_type(chunk);
         data = chunk + 8;
 
         /* parse chunks */
-        if (upng_chunk_type(chunk) == CHUNK_IDAT) {
-            memcpy(compressed + compressed_index, data, length);
+        if (type == CHUNK_IDAT) {
+            memmove(compressed + compressed_index, data, length);
             compressed_index += length;
-        } else if (upng_chunk_type(chunk) == CHUNK_IEND) {
+        } else if (type == CHUNK_IEND) {
             break;
         }
 
-        chunk += upng_chunk_length(chunk) + 12;
+        chunk += length + 12;
+    }
+
+    *size = compressed_size;
+    return compressed;
+}
+
+/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
+upng_error upng_decode(upng_t* upng)
+{
+    inflate_state state;
+    const unsigned char* compressed;
+    unsigned char* compressed_copy;
+    unsigned char* inflated;
+    unsigned long compressed_size = 0;
+    unsigned long inflated_size, inflated_pos = 0;
+
+    /* if we have an error state, bail now */
+    if (upng->error != UPNG_EOK) {
+        return upng->error;
+    }
+
+    /* parse the main header, if necessary */
+    upng_header(upng);
+    if (upng->error != UPNG_EOK) {
+        return upng->error;
+    }
+
+    /* if the state is not HEADER (meaning we are ready to decode the image), stop now */
+    if (upng->state != UPNG_HEADER) {
+        return upng->error;
+    }
+
+    /* release old result, if any */
+    if (upng->buffer != 0) {
+        free(upng->buffer);
+        upng->buffer = 0;
+        upng->size = 0;
+    }
+
+    compressed = upng_idat_stream(upng, &compressed_size, &compressed_copy);
+    if (compressed == NULL) {
+        upng_free_source(upng);
+        return upng->error;
     }
 
     /* allocate space to store inflated (but still filtered) data */
     inflated_size = ((upng->width * (upng->height * upng_get_bpp(upng) + 7)) / 8) + upng->height;
     inflated = (unsigned char*)malloc(inflated_size);
     if (inflated == NULL) {
-        free(compressed);
+        free(compressed_copy);
+        upng_free_source(upng);
         SET_ERROR(upng, UPNG_ENOMEM);
         return upng->error;
     }
 
     /* decompress image data */
-    error = uz_inflate(upng, inflated, inflated_size, compressed, compressed_size);
-    if (error != UPNG_EOK) {
-        free(compressed);
-        free(inflated);
-        return upng->error;
+    if (uz_inflate_init(upng, &state, compressed, compressed_size) == UPNG_EOK) {
+        uz_inflate_data(upng, &state, inflated, inflated_size, &inflated_pos, inflated_size);
     }
 
     /* free the compressed compressed data */
-    free(compressed);
+    free(compressed_copy);
+    if (upng->error != UPNG_EOK) {
+        free(inflated);
+        upng_free_source(upng);
+        return upng->error;
+    }
 
     /* allocate final image buffer */
     upng->size = (upng->height * upng->width * upng_get_bpp(upng) + 7) / 8;
     upng->buffer = (unsigned char*)malloc(upng->size);
     if (upng->buffer == NULL) {
         free(inflated);
+        upng_free_source(upng);
         upng->size = 0;
         SET_ERROR(upng, UPNG_ENOMEM);
         return upng->error;
@@ -1114,6 +1158,206 @@ upng_error upng_decode(upng_t* upng)
     return upng->error;
 }
 
+/*one sample of an unfiltered scanline, scaled to 8 bits*/
+static unsigned scanline_sample(const unsigned char* line, unsigned long index, unsigned depth)
+{
+    unsigned long bit;
+    unsigned value;
+
+    switch (depth) {
+    case 8:
+        return line[index];
+    case 16:
+        return line[index * 2]; /*keep the most significant byte */
+    default:
+        /* 1, 2 or 4 bits, packed from the most significant bit down */
+        bit = index * depth;
+        value = (line[bit >> 3] >> (8 - depth - (bit & 7))) & ((1u << depth) - 1);
+        return value * 255 / ((1u << depth) - 1);
+    }
+}
+
+/*convert an unfiltered scanline of any supported format to 32 bit RGBA pixels*/
+static void convert_scanline(const upng_t* upng, uint32_t* pixels, const unsigned char* line)
+{
+    unsigned components = upng_get_components(upng);
+    unsigned depth = upng->color_depth;
+    unsigned x;
+
+    for (x = 0; x < upng->width; x++) {
+        unsigned long i = (unsigned long)x * components;
+        uint32_t r, g, b, a = 255;
+
+        if (components <= 2) {
+            r = g = b = scanline_sample(line, i, depth);
+            if (components == 2) {
+                a = scanline_sample(line, i + 1, depth);
+            }
+        } else {
+            r = scanline_sample(line, i, depth);
+            g = scanline_sample(line, i + 1, depth);
+            b = scanline_sample(line, i + 2, depth);
+            if (components == 4) {
+                a = scanline_sample(line, i + 3, depth);
+            }
+        }
+
+        pixels[x] = r | (g << 8) | (b << 16) | (a << 24);
+    }
+}
+
+/*decode scanline by scanline and hand every row to callback as 32 bit RGBA pixels. The inflater writes into a
+  sliding buffer holding the LZ77 window and the next scanline, each scanline is unfiltered against the previous
+  one and converted, so the image is never held in memory by upng*/
+upng_error upng_decode_rows(upng_t* upng, upng_row_callback callback, void* user)
+{
+    inflate_state state;
+    const unsigned char* compressed;
+    unsigned char* compressed_copy;
+    unsigned long compressed_size = 0;
+    unsigned char* window;
+    unsigned char* line;
+    unsigned char* prevline;
+    uint32_t* pixels = NULL;
+    unsigned long linebytes, bytewidth, capacity;
+    unsigned long pos = 0, next = 0; /*end of the inflated data and start of the next scanline in window */
+    unsigned bpp;
+    unsigned y;
+
+    /* if we have an error state, bail now */
+    if (upng->error != UPNG_EOK) {
+        return upng->error;
+    }
+
+    /* parse the main header, if necessary */
+    upng_header(upng);
+    if (upng->error != UPNG_EOK) {
+        return upng->error;
+    }
+
+    /* if the state is not HEADER (meaning we are ready to decode the image), stop now */
+    if (upng->state != UPNG_HEADER) {
+        return upng->error;
+    }
+
+    compressed = upng_idat_stream(upng, &compressed_size, &compressed_copy);
+    if (compressed == NULL) {
+        upng_free_source(upng);
+        return upng->error;
+    }
+
+    bpp = upng_get_bpp(upng);
+    linebytes = ((unsigned long)upng->width * bpp + 7) / 8;
+    bytewidth = (bpp + 7) / 8;
+
+    /* twice the window, so sliding it back only happens once per window of output */
+    capacity = 2 * INFLATE_WINDOW_SIZE + linebytes + 1 + MAX_MATCH_LENGTH;
+    window = (unsigned char*)malloc(capacity);
+    line = (unsigned char*)malloc(linebytes);
+    prevline = (unsigned char*)malloc(linebytes);
+    if (upng->format != UPNG_RGBA8) {
+        pixels = (uint32_t*)malloc((unsigned long)upng->width * 4);
+    }
+    if (window == NULL || line == NULL || prevline == NULL || (upng->format != UPNG_RGBA8 && pixels == NULL)) {
+        SET_ERROR(upng, UPNG_ENOMEM);
+    } else {
+        uz_inflate_init(upng, &state, compressed, compressed_size);
+    }
+
+    for (y = 0; y < upng->height && upng->error == UPNG_EOK; y++) {
+        unsigned long end = next + 1 + linebytes; /*the extra filterbyte added to each row */
+
+        if (pos < end) {
+            /* make room for the scanline and one match past it, keeping the window behind pos */
+            if (end + MAX_MATCH_LENGTH > capacity) {
+                unsigned long keep = pos > INFLATE_WINDOW_SIZE ? pos - INFLATE_WINDOW_SIZE : 0;
+                if (keep > next) {
+                    keep = next;
+                }
+                memmove(window, window + keep, pos - keep);
+                pos -= keep;
+                next -= keep;
+                end -= keep;
+            }
+
+            uz_inflate_data(upng, &state, window, capacity, &pos, end);
+            if (upng->error != UPNG_EOK) {
+                break;
+            }
+
+            /* error: the stream ended before the last scanline */
+            if (pos < end) {
+                SET_ERROR(upng, UPNG_EMALFORMED);
+                break;
+            }
+        }
+
+        unfilter_scanline(upng, line, &window[next + 1], y > 0 ? prevline : NULL, bytewidth, window[next], linebytes);
+        if (upng->error != UPNG_EOK) {
+            break;
+        }
+        next = end;
+
+        /* the bytes of an RGBA8 scanline already are the pixels */
+        if (upng->format == UPNG_RGBA8) {
+            callback(user, y, (const uint32_t*)line);
+        } else {
+            convert_scanline(upng, pixels, line);
+            callback(user, y, pixels);
+        }
+
+        /* the scanline just unfiltered is the previous one of the next */
+        {
+            unsigned char* swap = prevline;
+            prevline = line;
+            line = swap;
+        }
+    }
+
+    free(window);
+    free(line);
+    free(prevline);
+    free(pixels);
+    free(compressed_copy);
+
+    if (upng->error == UPNG_EOK) {
+        upng->state = UPNG_DECODED;
+    }
+
+    /* we are done with our input buffer; free it if we own it */
+    upng_free_source(upng);
+
+    return upng->error;
+}
+
+typedef struct upng_rgba32_target {
+    unsigned char* out;
+    unsigned long pitch;
+    unsigned width;
+} upng_rgba32_target;
+
+static void upng_store_row(void* user, unsigned y, const uint32_t* pixels)
+{
+    upng_rgba32_target* target = (upng_rgba32_target*)user;
+    memcpy(target->out + y * target->pitch, pixels, (unsigned long)target->width * 4);
+}
+
+upng_error upng_decode_rgba32(upng_t* upng, uint32_t* out, unsigned long pitch)
+{
+    upng_rgba32_target target;
+
+    /* parse the main header, if necessary, for the row width */
+    if (upng_header(upng) != UPNG_EOK) {
+        return upng->error;
+    }
+
+    target.out = (unsigned char*)out;
+    target.pitch = pitch != 0 ? pitch : (unsigned long)upng->width * 4;
+    target.width = upng->width;
+
+    return upng_decode_rows(upng, upng_store_row, &target);
+}
+
 static upng_t* upng_new(void)
 {
     upng_t* upng;
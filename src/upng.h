@@ -27,6 +27,8 @@ freely, subject to the following restrictions:
 #if !defined(UPNG_H)
 #    define UPNG_H
 
+#    include <stdint.h>
+
 typedef enum upng_error {
     UPNG_EOK = 0,           /* success (no error) */
     UPNG_ENOMEM = 1,        /* memory allocation failed */
@@ -57,6 +59,9 @@ typedef enum upng_format {
 
 typedef struct upng_t upng_t;
 
+/* receives row y of the image as 32 bit RGBA pixels, R in the lowest byte (0xAABBGGRR) */
+typedef void (*upng_row_callback)(void* user, unsigned y, const uint32_t* pixels);
+
 upng_t* upng_new_from_bytes(const unsigned char* buffer, unsigned long size);
 upng_t* upng_new_from_file(const char* path);
 void upng_free(upng_t* upng);
@@ -64,6 +69,12 @@ void upng_free(upng_t* upng);
 upng_error upng_header(upng_t* upng);
 upng_error upng_decode(upng_t* upng);
 
+/* decode any supported format straight to 32 bit RGBA pixels, one scanline at a time, without
+   keeping the image in upng; upng_get_buffer stays empty. upng_decode_rgba32 writes row y to
+   out + y * pitch bytes (0 for tightly packed rows), the caller owns and may align out */
+upng_error upng_decode_rows(upng_t* upng, upng_row_callback callback, void* user);
+upng_error upng_decode_rgba32(upng_t* upng, uint32_t* out, unsigned long pitch);
+
 upng_error upng_get_error(const upng_t* upng);
 unsigned upng_get_error_line(const upng_t* upng);
 